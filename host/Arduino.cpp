@@ -0,0 +1,849 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "hal_detail.h"
+
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+
+namespace {
+
+    const uint8_t PINS = 20;
+
+    // millis() interrupt period of the 16 MHz board
+    const uint64_t TIMER0_OVF_US = 1024;
+
+    uint64_t clock_us = 0;
+
+    struct TimerIsr {
+        void (*isr)();
+        uint64_t period_us;
+        uint64_t next_us;
+    };
+
+    std::vector<TimerIsr> timer_isrs;
+    bool irq_enabled = true;
+    bool in_isr = false;
+
+    // Run every timer interrupt due up to the given moment in the order they fire
+    void dispatch(uint64_t upto)
+    {
+        if (in_isr || !irq_enabled)
+            return;
+
+        in_isr = true;
+        for (;;) {
+            size_t due = timer_isrs.size();
+            for (size_t i = 0; i < timer_isrs.size(); i++)
+                if (timer_isrs[i].next_us <= upto &&
+                    (due == timer_isrs.size() || timer_isrs[i].next_us < timer_isrs[due].next_us))
+                    due = i;
+            if (due == timer_isrs.size())
+                break;
+
+            if (timer_isrs[due].next_us > clock_us)
+                clock_us = timer_isrs[due].next_us;
+            timer_isrs[due].next_us += timer_isrs[due].period_us;
+            timer_isrs[due].isr();
+        }
+        in_isr = false;
+    }
+
+    std::vector<hal::AdcPoint> adc_script[PINS];
+    size_t adc_pos[PINS];
+    uint16_t adc_level[PINS];
+    uint32_t adc_read_count = 0;
+
+    struct AdcNoise {
+        double sigma;
+        double glitch;
+    } adc_noise_of[PINS];
+    std::mt19937 noise_rng;
+
+    int pwm[PINS];
+    uint8_t pin_state[PINS];
+    uint8_t pin_mode[PINS];
+
+    // closed switches between two pins or a pin and the ground
+    struct Switch {
+        uint8_t a;
+        uint8_t b;
+    };
+
+    std::vector<Switch> switches;
+    void (*pin_change_isr)() = NULL;
+    bool pin_change_pending = false;
+
+    void fire_pin_change()
+    {
+        if (!pin_change_pending || pin_change_isr == NULL || in_isr || !irq_enabled)
+            return;
+
+        pin_change_pending = false;
+        in_isr = true;
+        pin_change_isr();
+        in_isr = false;
+    }
+
+    std::vector<hal::Tone> tone_log;
+    std::string serial_out;
+    uint32_t audio_sample_count = 0;
+
+    // avr-libc random() state, so host sessions draw the same numbers as the board
+    uint32_t rnd_ctx = 1;
+
+    int32_t do_random()
+    {
+        int32_t hi, lo, x = int32_t(rnd_ctx);
+
+        if (x == 0)
+            x = 123459876L;
+        hi = x / 127773L;
+        lo = x % 127773L;
+        x = 16807L * lo - 2836L * hi;
+        if (x < 0)
+            x += 0x7fffffffL;
+        rnd_ctx = uint32_t(x);
+
+        return x;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+// Arduino core
+//------------------------------------------------------------------------------------------
+unsigned long millis()
+{
+    return (unsigned long)(clock_us / 1000);
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long micros()
+{
+    return (unsigned long)clock_us;
+}
+
+
+//------------------------------------------------------------------------------------------
+void delay(unsigned long ms)
+{
+    hal::advance_us(uint64_t(ms) * 1000);
+}
+
+
+//------------------------------------------------------------------------------------------
+void delayMicroseconds(unsigned int us)
+{
+    hal::advance_us(us);
+}
+
+
+//------------------------------------------------------------------------------------------
+void interrupts()
+{
+    irq_enabled = true;
+    fire_pin_change();
+    dispatch(clock_us);
+}
+
+
+//------------------------------------------------------------------------------------------
+void noInterrupts()
+{
+    irq_enabled = false;
+}
+
+
+//------------------------------------------------------------------------------------------
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin >= PINS)
+        return;
+
+    pin_mode[pin] = mode;
+    if (mode == INPUT_PULLUP)
+        pin_state[pin] = HIGH;
+}
+
+
+//------------------------------------------------------------------------------------------
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin >= PINS)
+        return;
+
+    pin_state[pin] = val ? HIGH : LOW;
+    hal::detail::lcd_pin(pin, pin_state[pin]);
+}
+
+
+//------------------------------------------------------------------------------------------
+int digitalRead(uint8_t pin)
+{
+    if (pin >= PINS)
+        return LOW;
+    if (pin_mode[pin] == OUTPUT)
+        return pin_state[pin];
+
+    // a closed switch pulls an input down to the ground or to an output driven low
+    for (size_t i = 0; i < switches.size(); i++) {
+        uint8_t other;
+        if (switches[i].a == pin)
+            other = switches[i].b;
+        else if (switches[i].b == pin)
+            other = switches[i].a;
+        else
+            continue;
+
+        if (other == hal::GND || (other < PINS && pin_mode[other] == OUTPUT && pin_state[other] == LOW))
+            return LOW;
+    }
+
+    return pin_state[pin];
+}
+
+
+//------------------------------------------------------------------------------------------
+int analogRead(uint8_t pin)
+{
+    // both channel number and An pin names are accepted like on the board
+    if (pin >= A0)
+        pin -= A0;
+    if (pin >= PINS)
+        return 0;
+
+    adc_read_count++;
+
+    // the clock never goes back, so the script is consumed from where the last read stopped
+    uint64_t now = millis();
+    const std::vector<hal::AdcPoint> &script = adc_script[pin];
+    for (; adc_pos[pin] < script.size() && script[adc_pos[pin]].at_ms <= now; adc_pos[pin]++)
+        adc_level[pin] = script[adc_pos[pin]].value;
+
+    const AdcNoise &n = adc_noise_of[pin];
+    if (n.sigma == 0 && n.glitch == 0)
+        return adc_level[pin];
+
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+    if (chance(noise_rng) < n.glitch)
+        return int(noise_rng() % 1024);
+    std::normal_distribution<double> noise(0.0, n.sigma);
+    long v = lround(adc_level[pin] + noise(noise_rng));
+
+    return int(v < 0 ? 0 : v > 1023 ? 1023 : v);
+}
+
+
+//------------------------------------------------------------------------------------------
+void analogWrite(uint8_t pin, int val)
+{
+    if (pin < PINS)
+        pwm[pin] = val;
+}
+
+
+//------------------------------------------------------------------------------------------
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration)
+{
+    hal::detail::Untracked untracked;
+    hal::Tone t = {millis(), pin, frequency, duration};
+    tone_log.push_back(t);
+}
+
+
+//------------------------------------------------------------------------------------------
+void noTone(uint8_t pin)
+{
+    hal::detail::Untracked untracked;
+    hal::Tone t = {millis(), pin, 0, 0};
+    tone_log.push_back(t);
+}
+
+
+//------------------------------------------------------------------------------------------
+void randomSeed(unsigned long seed)
+{
+    if (seed != 0)
+        rnd_ctx = uint32_t(seed);
+}
+
+
+//------------------------------------------------------------------------------------------
+long random(long howbig)
+{
+    if (howbig == 0)
+        return 0;
+
+    return do_random() % howbig;
+}
+
+
+//------------------------------------------------------------------------------------------
+long random(long howsmall, long howbig)
+{
+    if (howsmall >= howbig)
+        return howsmall;
+
+    return random(howbig - howsmall) + howsmall;
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t Print::write(const char *str)
+{
+    size_t n = 0;
+    while (*str)
+        n += write(uint8_t(*str++));
+
+    return n;
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t Print::print(long num, int base)
+{
+    if (num < 0 && base == DEC)
+        return write(uint8_t('-')) + print((unsigned long)(-num), base);
+
+    return print((unsigned long)num, base);
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t Print::print(unsigned long num, int base)
+{
+    char buf[sizeof(unsigned long) * 8 + 1];
+    char *p = &buf[sizeof(buf) - 1];
+    *p = 0;
+    if (base < 2)
+        base = DEC;
+    do {
+        unsigned d = num % base;
+        *--p = char(d < 10 ? '0' + d : 'A' + d - 10);
+        num /= base;
+    } while (num != 0);
+
+    return write(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+HardwareSerial Serial;
+
+size_t HardwareSerial::write(uint8_t c)
+{
+    hal::detail::Untracked untracked;
+    serial_out += char(c);
+
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------------------
+// hal control
+//------------------------------------------------------------------------------------------
+void hal::reset()
+{
+    clock_us = 0;
+    timer_isrs.clear();
+    irq_enabled = true;
+
+    for (uint8_t i = 0; i < PINS; i++) {
+        adc_script[i].clear();
+        adc_pos[i] = 0;
+        adc_level[i] = 0;
+        pwm[i] = 0;
+        pin_state[i] = LOW;
+        pin_mode[i] = INPUT;
+    }
+    switches.clear();
+    pin_change_isr = NULL;
+    pin_change_pending = false;
+    adc_read_count = 0;
+    for (uint8_t i = 0; i < PINS; i++)
+        adc_noise_of[i].sigma = adc_noise_of[i].glitch = 0;
+    noise_rng.seed(1);
+
+    tone_log.clear();
+    serial_out.clear();
+    audio_sample_count = 0;
+    rnd_ctx = 1;
+
+    detail::reset_eeprom();
+    detail::reset_lcd();
+}
+
+
+//------------------------------------------------------------------------------------------
+uint64_t hal::now_us()
+{
+    return clock_us;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::set_us(uint64_t us)
+{
+    if (us <= clock_us)
+        return;
+
+    dispatch(us);
+    if (us > clock_us)
+        clock_us = us;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::advance_us(uint64_t us)
+{
+    set_us(clock_us + us);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::attach_isr(void (*isr)(), uint32_t period_us)
+{
+    detach_isr(isr);
+
+    detail::Untracked untracked;
+    TimerIsr t = {isr, period_us, clock_us + period_us};
+    timer_isrs.push_back(t);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::wait_for_interrupt()
+{
+    uint64_t wake = (clock_us / TIMER0_OVF_US + 1) * TIMER0_OVF_US;
+    for (size_t i = 0; i < timer_isrs.size(); i++)
+        if (timer_isrs[i].next_us < wake)
+            wake = timer_isrs[i].next_us;
+
+    // an interrupt already pending fires as soon as they are enabled
+    irq_enabled = true;
+    if (wake <= clock_us)
+        dispatch(clock_us);
+    else
+        set_us(wake);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::detach_isr(void (*isr)())
+{
+    for (size_t i = 0; i < timer_isrs.size(); i++)
+        if (timer_isrs[i].isr == isr) {
+            timer_isrs.erase(timer_isrs.begin() + i);
+            break;
+        }
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::adc_set(uint8_t pin, uint16_t value)
+{
+    if (pin >= PINS)
+        return;
+
+    adc_script[pin].clear();
+    adc_pos[pin] = 0;
+    adc_level[pin] = value;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::adc_push(uint8_t pin, uint64_t at_ms, uint16_t value)
+{
+    if (pin >= PINS)
+        return;
+
+    detail::Untracked untracked;
+    AdcPoint p = {at_ms, value};
+    adc_script[pin].push_back(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::adc_noise(uint8_t pin, double sigma, double glitch, uint32_t seed)
+{
+    if (pin >= PINS)
+        return;
+
+    adc_noise_of[pin].sigma = sigma;
+    adc_noise_of[pin].glitch = glitch;
+    noise_rng.seed(seed);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint64_t hal::adc_next_change(uint64_t after_ms)
+{
+    uint64_t next = UINT64_MAX;
+
+    for (uint8_t i = 0; i < PINS; i++)
+        for (size_t j = adc_pos[i]; j < adc_script[i].size(); j++)
+            if (adc_script[i][j].at_ms > after_ms) {
+                if (adc_script[i][j].at_ms < next)
+                    next = adc_script[i][j].at_ms;
+                break;
+            }
+
+    return next;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::adc_reads()
+{
+    return adc_read_count;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::switch_set(uint8_t a, uint8_t b, bool closed)
+{
+    hal::detail::Untracked untracked;
+
+    for (size_t i = 0; i < switches.size(); i++)
+        if ((switches[i].a == a && switches[i].b == b) || (switches[i].a == b && switches[i].b == a)) {
+            if (closed)
+                return;
+            switches.erase(switches.begin() + i);
+            pin_change_pending = true;
+            fire_pin_change();
+            return;
+        }
+
+    if (!closed)
+        return;
+
+    Switch sw = {a, b};
+    switches.push_back(sw);
+    pin_change_pending = true;
+    fire_pin_change();
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::attach_pin_change(void (*isr)())
+{
+    pin_change_isr = isr;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::detach_pin_change(void (*isr)())
+{
+    if (pin_change_isr == isr)
+        pin_change_isr = NULL;
+}
+
+
+//------------------------------------------------------------------------------------------
+int hal::pwm_level(uint8_t pin)
+{
+    return pin < PINS ? pwm[pin] : 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+const std::vector<hal::Tone>& hal::tones()
+{
+    return tone_log;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::clear_tones()
+{
+    tone_log.clear();
+}
+
+
+//------------------------------------------------------------------------------------------
+const std::string& hal::serial_output()
+{
+    return serial_out;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::clear_serial()
+{
+    serial_out.clear();
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::audio_note(uint8_t pin, unsigned int freq)
+{
+    detail::Untracked untracked;
+    Tone t = {millis(), pin, freq, 0};
+    tone_log.push_back(t);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::audio_sample(uint8_t pin, uint8_t duty)
+{
+    if (pin < PINS)
+        pwm[pin] = duty;
+    audio_sample_count++;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::audio_samples()
+{
+    return audio_sample_count;
+}
+
+
+//------------------------------------------------------------------------------------------
+// String
+//------------------------------------------------------------------------------------------
+String::String(const char *cstr) :
+    buffer(NULL),
+    len(0)
+{
+    assign(cstr ? cstr : "", cstr ? strlen(cstr) : 0);
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(const String &str) :
+    buffer(NULL),
+    len(0)
+{
+    assign(str.buffer, str.len);
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(char c) :
+    buffer(NULL),
+    len(0)
+{
+    assign(&c, 1);
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(unsigned char num) :
+    buffer(NULL),
+    len(0)
+{
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%u", num);
+    assign(buf, strlen(buf));
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(int num) :
+    buffer(NULL),
+    len(0)
+{
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%d", num);
+    assign(buf, strlen(buf));
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(unsigned int num) :
+    buffer(NULL),
+    len(0)
+{
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%u", num);
+    assign(buf, strlen(buf));
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(long num) :
+    buffer(NULL),
+    len(0)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", num);
+    assign(buf, strlen(buf));
+}
+
+
+//------------------------------------------------------------------------------------------
+String::String(unsigned long num) :
+    buffer(NULL),
+    len(0)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", num);
+    assign(buf, strlen(buf));
+}
+
+
+//------------------------------------------------------------------------------------------
+String::~String()
+{
+    delete[] buffer;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator = (const String &rhs)
+{
+    if (this != &rhs)
+        assign(rhs.buffer, rhs.len);
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator = (const char *cstr)
+{
+    assign(cstr, strlen(cstr));
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (const String &rhs)
+{
+    append(rhs.buffer, rhs.len);
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (const char *cstr)
+{
+    append(cstr, strlen(cstr));
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (char c)
+{
+    append(&c, 1);
+
+    return *this;
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (unsigned char num)
+{
+    return *this += String(num);
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (int num)
+{
+    return *this += String(num);
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (unsigned int num)
+{
+    return *this += String(num);
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (long num)
+{
+    return *this += String(num);
+}
+
+
+//------------------------------------------------------------------------------------------
+String& String::operator += (unsigned long num)
+{
+    return *this += String(num);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool String::operator == (const String &rhs) const
+{
+    return len == rhs.len && memcmp(buffer, rhs.buffer, len) == 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool String::operator == (const char *cstr) const
+{
+    return strcmp(buffer, cstr) == 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+char String::operator [] (unsigned int index) const
+{
+    return index < len ? buffer[index] : 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+String String::substring(unsigned int from) const
+{
+    return substring(from, len);
+}
+
+
+//------------------------------------------------------------------------------------------
+String String::substring(unsigned int from, unsigned int to) const
+{
+    if (from > to) {
+        unsigned int t = from;
+        from = to;
+        to = t;
+    }
+    if (from > len)
+        return String();
+    if (to > len)
+        to = len;
+
+    String s;
+    s.assign(buffer + from, to - from);
+
+    return s;
+}
+
+
+//------------------------------------------------------------------------------------------
+void String::assign(const char *cstr, unsigned int length)
+{
+    char *nb = new char[length + 1];
+    memcpy(nb, cstr, length);
+    nb[length] = 0;
+
+    delete[] buffer;
+    buffer = nb;
+    len = length;
+}
+
+
+//------------------------------------------------------------------------------------------
+void String::append(const char *cstr, unsigned int length)
+{
+    char *nb = new char[len + length + 1];
+    memcpy(nb, buffer, len);
+    memcpy(nb + len, cstr, length);
+    nb[len + length] = 0;
+
+    delete[] buffer;
+    buffer = nb;
+    len += length;
+}
@@ -0,0 +1,149 @@
+/*
+* Host-side stand-in for the Arduino core.
+*
+* Provides just enough of the Arduino API (time, ADC, PWM, tone, random,
+* Serial and String) for rtimer and the Keys library to compile and run on a Linux host.
+* All the hardware is simulated in memory and driven through hal.h
+*/
+
+#ifndef __HOST_ARDUINO_H_
+#define __HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x0
+#define OUTPUT       0x1
+#define INPUT_PULLUP 0x2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+// program memory is plain memory on the host
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define strlen_P strlen
+#define memcpy_P memcpy
+
+// time
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// interrupts
+void interrupts();
+void noInterrupts();
+
+// digital and analog IO
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+// sound
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+
+// pseudo-random numbers
+void randomSeed(unsigned long seed);
+long random(long howbig);
+long random(long howsmall, long howbig);
+
+
+//------------------------------------------------------------------------------------------
+// Text output of the Print class. Numbers are printed in the base, DEC or HEX
+#define DEC 10
+#define HEX 16
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t c) = 0;
+        size_t write(const char *str);
+
+        size_t print(const char *str) { return write(str); }
+        size_t print(char c) { return write(uint8_t(c)); }
+        size_t print(unsigned char num, int base = DEC) { return print((unsigned long)num, base); }
+        size_t print(int num, int base = DEC) { return print(long(num), base); }
+        size_t print(unsigned int num, int base = DEC) { return print((unsigned long)num, base); }
+        size_t print(long num, int base = DEC);
+        size_t print(unsigned long num, int base = DEC);
+
+        size_t println() { return write(uint8_t('\r')) + write(uint8_t('\n')); }
+        template <typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+        template <typename T> size_t println(T val, int base) { size_t n = print(val, base); return n + println(); }
+};
+
+// The board's serial port. What it sends is kept by the hal
+class HardwareSerial : public Print {
+    public:
+        void begin(unsigned long) {}
+        void end() {}
+        virtual size_t write(uint8_t c);
+        using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+
+//------------------------------------------------------------------------------------------
+// Minimal WString replacement. Like the original it keeps its text on the heap
+class String {
+    public:
+        String(const char *cstr = "");
+        String(const String &str);
+        explicit String(char c);
+        String(unsigned char num);
+        String(int num);
+        String(unsigned int num);
+        String(long num);
+        String(unsigned long num);
+        ~String();
+
+        String& operator = (const String &rhs);
+        String& operator = (const char *cstr);
+
+        String& operator += (const String &rhs);
+        String& operator += (const char *cstr);
+        String& operator += (char c);
+        String& operator += (unsigned char num);
+        String& operator += (int num);
+        String& operator += (unsigned int num);
+        String& operator += (long num);
+        String& operator += (unsigned long num);
+
+        bool operator == (const String &rhs) const;
+        bool operator == (const char *cstr) const;
+        bool operator != (const String &rhs) const { return !(*this == rhs); }
+        bool operator != (const char *cstr) const { return !(*this == cstr); }
+
+        char operator [] (unsigned int index) const;
+
+        unsigned int length() const { return len; }
+        const char* c_str() const { return buffer; }
+        String substring(unsigned int from) const;
+        String substring(unsigned int from, unsigned int to) const;
+
+    private:
+        char *buffer;
+        unsigned int len;
+
+        void assign(const char *cstr, unsigned int length);
+        void append(const char *cstr, unsigned int length);
+};
+
+#endif // __HOST_ARDUINO_H_
@@ -0,0 +1,105 @@
+#include "EEPROM.h"
+#include "hal.h"
+#include "hal_detail.h"
+
+
+EEPROMClass EEPROM;
+
+
+namespace {
+
+    uint8_t cells[hal::EEPROM_SIZE];
+    uint32_t cell_writes[hal::EEPROM_SIZE];
+    uint32_t total_writes = 0;
+
+    // erase/write cycle of an AVR EEPROM cell takes 3.3 ms and blocks the caller
+    const uint64_t WRITE_US = 3300;
+
+    // a blank chip reads 0xFF everywhere, even before the first hal::reset()
+    struct Blank {
+        Blank() { hal::eeprom_erase(); }
+    } blank;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t EEPROMClass::read(int idx)
+{
+    if (idx < 0 || idx >= hal::EEPROM_SIZE)
+        return 0xFF;
+
+    return cells[idx];
+}
+
+
+//------------------------------------------------------------------------------------------
+void EEPROMClass::write(int idx, uint8_t val)
+{
+    if (idx < 0 || idx >= hal::EEPROM_SIZE)
+        return;
+
+    cells[idx] = val;
+    cell_writes[idx]++;
+    total_writes++;
+    hal::advance_us(WRITE_US);
+}
+
+
+//------------------------------------------------------------------------------------------
+void EEPROMClass::update(int idx, uint8_t val)
+{
+    if (read(idx) != val)
+        write(idx, val);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t EEPROMClass::length()
+{
+    return hal::EEPROM_SIZE;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::detail::reset_eeprom()
+{
+    eeprom_erase();
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::eeprom_erase()
+{
+    memset(cells, 0xFF, sizeof(cells));
+    memset(cell_writes, 0, sizeof(cell_writes));
+    total_writes = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t hal::eeprom_peek(uint16_t addr)
+{
+    return addr < EEPROM_SIZE ? cells[addr] : 0xFF;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::eeprom_poke(uint16_t addr, uint8_t val)
+{
+    if (addr < EEPROM_SIZE)
+        cells[addr] = val;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::eeprom_writes(uint16_t addr)
+{
+    return addr < EEPROM_SIZE ? cell_writes[addr] : 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::eeprom_total_writes()
+{
+    return total_writes;
+}
@@ -0,0 +1,20 @@
+/*
+* Host-side in-memory replacement of the AVR EEPROM library
+*/
+
+#ifndef __HOST_EEPROM_H_
+#define __HOST_EEPROM_H_
+
+#include "Arduino.h"
+
+class EEPROMClass {
+    public:
+        uint8_t read(int idx);
+        void write(int idx, uint8_t val);
+        void update(int idx, uint8_t val);
+        uint16_t length();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // __HOST_EEPROM_H_
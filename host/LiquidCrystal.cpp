@@ -0,0 +1,274 @@
+#include "LiquidCrystal.h"
+#include "hal.h"
+#include "hal_detail.h"
+
+#include <stdio.h>
+
+
+namespace {
+
+    // HD44780 display RAM: 40 characters per line, the second line starts at 0x40
+    const uint8_t DDRAM_LINE = 40;
+    const uint8_t ROW_OFFSET[2] = {0x00, 0x40};
+
+    char ddram[2][DDRAM_LINE];
+    uint8_t address = 0;
+
+    uint32_t data_writes = 0;
+    uint32_t commands = 0;
+    uint64_t busy_us = 0;
+
+    // LiquidCrystal sends a byte as two nibbles, each followed by a 100 us wait,
+    // clear and home commands need another 2 ms on top of that
+    const uint64_t BYTE_US = 2 * 102;
+    const uint64_t SLOW_CMD_US = 2000;
+
+    // pins of the 4-bit bus. A byte is latched as two nibbles on falling edges of enable
+    bool bus_attached = false;
+    uint8_t bus_rs, bus_en, bus_d[4];
+    uint8_t bus_en_state = LOW;
+    uint8_t bus_high_nibble = 0;
+    bool bus_second_nibble = false;
+
+    void spend(uint64_t us)
+    {
+        busy_us += us;
+        hal::advance_us(us);
+    }
+
+    void exec_command(uint8_t value)
+    {
+        commands++;
+
+        if (value & 0x80)
+            address = value & 0x7F;
+        else if (value == 0x01) {
+            memset(ddram, ' ', sizeof(ddram));
+            address = 0;
+        }
+        else if ((value & 0xFE) == 0x02)
+            address = 0;
+    }
+
+    void store_data(uint8_t value)
+    {
+        data_writes++;
+
+        uint8_t row = address >= ROW_OFFSET[1] ? 1 : 0,
+                col = address - ROW_OFFSET[row];
+        if (col < DDRAM_LINE)
+            ddram[row][col] = char(value);
+
+        // address counter wraps from the end of the first line to the second one and back
+        if (++address == ROW_OFFSET[0] + DDRAM_LINE)
+            address = ROW_OFFSET[1];
+        else if (address == ROW_OFFSET[1] + DDRAM_LINE)
+            address = ROW_OFFSET[0];
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t enable,
+                             uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3) :
+    numlines(1)
+{
+    bus_attached = true;
+    bus_rs = rs;
+    bus_en = enable;
+    bus_d[0] = d0;
+    bus_d[1] = d1;
+    bus_d[2] = d2;
+    bus_d[3] = d3;
+    bus_second_nibble = false;
+}
+
+
+//------------------------------------------------------------------------------------------
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows)
+{
+    (void)cols;
+    numlines = rows;
+
+    // function set, display control, clear and entry mode like the real library does
+    command(0x28);
+    command(0x0C);
+    clear();
+    command(0x06);
+}
+
+
+//------------------------------------------------------------------------------------------
+void LiquidCrystal::clear()
+{
+    command(0x01);
+}
+
+
+//------------------------------------------------------------------------------------------
+void LiquidCrystal::home()
+{
+    command(0x02);
+}
+
+
+//------------------------------------------------------------------------------------------
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
+{
+    if (row >= numlines)
+        row = numlines - 1;
+    if (row > 1)
+        row = 1;
+
+    command(0x80 | (col + ROW_OFFSET[row]));
+}
+
+
+//------------------------------------------------------------------------------------------
+void LiquidCrystal::command(uint8_t value)
+{
+    exec_command(value);
+
+    spend(BYTE_US);
+    if (value < 0x04 && value != 0)
+        spend(SLOW_CMD_US);
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::write(uint8_t value)
+{
+    store_data(value);
+    spend(BYTE_US);
+
+    return 1;
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(const char *str)
+{
+    size_t n = 0;
+    while (*str)
+        n += write(uint8_t(*str++));
+
+    return n;
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(const String &str)
+{
+    return print(str.c_str());
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(char c)
+{
+    return write(uint8_t(c));
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(int num)
+{
+    return print(long(num));
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(unsigned int num)
+{
+    return print((unsigned long)num);
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(long num)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", num);
+
+    return print(buf);
+}
+
+
+//------------------------------------------------------------------------------------------
+size_t LiquidCrystal::print(unsigned long num)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%lu", num);
+
+    return print(buf);
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::detail::lcd_pin(uint8_t pin, uint8_t val)
+{
+    if (!bus_attached || pin != bus_en)
+        return;
+
+    if (bus_en_state == HIGH && val == LOW) {
+        uint8_t nibble = 0;
+        for (uint8_t i = 0; i < 4; i++)
+            if (digitalRead(bus_d[i]) == HIGH)
+                nibble |= 1 << i;
+
+        if (!bus_second_nibble)
+            bus_high_nibble = nibble;
+        else if (digitalRead(bus_rs) == HIGH)
+            store_data(uint8_t(bus_high_nibble << 4 | nibble));
+        else
+            exec_command(uint8_t(bus_high_nibble << 4 | nibble));
+        bus_second_nibble = !bus_second_nibble;
+    }
+    bus_en_state = val;
+}
+
+
+//------------------------------------------------------------------------------------------
+void hal::detail::reset_lcd()
+{
+    bus_attached = false;
+    bus_en_state = LOW;
+    bus_second_nibble = false;
+
+    memset(ddram, ' ', sizeof(ddram));
+    address = 0;
+    data_writes = 0;
+    commands = 0;
+    busy_us = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+std::string hal::lcd_line(uint8_t row)
+{
+    if (row > 1)
+        return std::string();
+
+    return std::string(ddram[row], 16);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::lcd_data_writes()
+{
+    return data_writes;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::lcd_commands()
+{
+    return commands;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint64_t hal::lcd_busy_us()
+{
+    return busy_us;
+}
@@ -0,0 +1,39 @@
+/*
+* Host-side model of the HD44780 character display driven by LiquidCrystal.
+*
+* The model keeps the display RAM and charges the fake clock the same time the
+* 4-bit LiquidCrystal library spends on every byte sent to the controller.
+* Bytes clocked into the pins directly are decoded too, but cost no time
+*/
+
+#ifndef __HOST_LIQUIDCRYSTAL_H_
+#define __HOST_LIQUIDCRYSTAL_H_
+
+#include "Arduino.h"
+
+class LiquidCrystal {
+    public:
+        LiquidCrystal(uint8_t rs, uint8_t enable,
+                      uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+
+        void begin(uint8_t cols, uint8_t rows);
+        void clear();
+        void home();
+        void setCursor(uint8_t col, uint8_t row);
+
+        void command(uint8_t value);
+        size_t write(uint8_t value);
+
+        size_t print(const char *str);
+        size_t print(const String &str);
+        size_t print(char c);
+        size_t print(int num);
+        size_t print(unsigned int num);
+        size_t print(long num);
+        size_t print(unsigned long num);
+
+    private:
+        uint8_t numlines;
+};
+
+#endif // __HOST_LIQUIDCRYSTAL_H_
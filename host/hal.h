@@ -0,0 +1,142 @@
+/*
+* Host-side control of the simulated Arduino hardware.
+*
+* The fake clock, the scripted ADC, the in-memory EEPROM, the 16x2 LCD model
+* and the tone recorder are all driven and inspected from here. Firmware
+* sources include it only to hook their interrupt handlers under RTIMER_HOST
+*/
+
+#ifndef __HOST_HAL_H_
+#define __HOST_HAL_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace hal {
+
+    // Bring every simulated device back to its power-on state
+    void reset();
+
+    //------------------------------------------------------------
+    // Fake clock
+    //------------------------------------------------------------
+    uint64_t now_us();
+    void set_us(uint64_t us);
+    void advance_us(uint64_t us);
+    inline void advance_ms(uint64_t ms) { advance_us(ms * 1000); }
+
+    //------------------------------------------------------------
+    // Timer interrupts
+    //------------------------------------------------------------
+    // The handler is called every period_us while the fake clock moves on,
+    // each time with the clock set to the moment the interrupt fires.
+    // noInterrupts() holds the calls back until interrupts() is called
+    void attach_isr(void (*isr)(), uint32_t period_us);
+    void detach_isr(void (*isr)());
+
+    // Idle sleep: enable interrupts and move the clock to the next one. Timer0
+    // overflows every 1024 us for millis() and wakes the MCU even when no
+    // handler is attached
+    void wait_for_interrupt();
+
+    //------------------------------------------------------------
+    // Scripted ADC
+    //------------------------------------------------------------
+    // Single scripted sample: from time at_ms on the pin reads value
+    struct AdcPoint {
+        uint64_t at_ms;
+        uint16_t value;
+    };
+
+    // Set a constant level for the pin and drop its script
+    void adc_set(uint8_t pin, uint16_t value);
+    // Append a level change to the pin's script. Points should be added in time order
+    void adc_push(uint8_t pin, uint64_t at_ms, uint16_t value);
+    // Noise of every read of the pin: a gaussian one of sigma and, with the
+    // probability glitch, a read of a random level instead of the scripted one
+    void adc_noise(uint8_t pin, double sigma, double glitch, uint32_t seed = 1);
+    // Time of the first scripted change after the given moment or UINT64_MAX
+    uint64_t adc_next_change(uint64_t after_ms);
+    uint32_t adc_reads();
+
+    // Last analogWrite() value of the pin
+    int pwm_level(uint8_t pin);
+
+    //------------------------------------------------------------
+    // Switches
+    //------------------------------------------------------------
+    // A closed switch connects two pins, or a pin and GND. digitalRead() of
+    // an input gives LOW while a switch connects it to the ground or to an
+    // output driven low, which is enough for buttons and matrix keypads
+    const uint8_t GND = 0xFF;
+
+    void switch_set(uint8_t a, uint8_t b, bool closed);
+    // Pin change interrupt, called on every switch change like PCINT would
+    // be on a watched pin. noInterrupts() holds it back
+    void attach_pin_change(void (*isr)());
+    void detach_pin_change(void (*isr)());
+
+    //------------------------------------------------------------
+    // In-memory EEPROM
+    //------------------------------------------------------------
+    const uint16_t EEPROM_SIZE = 1024;
+
+    void eeprom_erase();
+    uint8_t eeprom_peek(uint16_t addr);
+    void eeprom_poke(uint16_t addr, uint8_t val);
+    // Number of real cell writes (updates which didn't change a cell aren't counted)
+    uint32_t eeprom_writes(uint16_t addr);
+    uint32_t eeprom_total_writes();
+
+    //------------------------------------------------------------
+    // HD44780 16x2 LCD model
+    //------------------------------------------------------------
+    // Besides the LiquidCrystal calls the model listens to the display pins,
+    // so bytes bit-banged in 4-bit mode by the firmware reach it as well
+    std::string lcd_line(uint8_t row);
+    uint32_t lcd_data_writes();
+    uint32_t lcd_commands();
+    // Time the MCU spent waiting on the display bus
+    uint64_t lcd_busy_us();
+
+    //------------------------------------------------------------
+    // Serial port
+    //------------------------------------------------------------
+    // Everything written to Serial since the last clear
+    const std::string& serial_output();
+    void clear_serial();
+
+    //------------------------------------------------------------
+    // Heap usage
+    //------------------------------------------------------------
+    // Number and total size of operator new calls made by the firmware so far
+    uint32_t heap_allocs();
+    uint64_t heap_alloc_bytes();
+
+    //------------------------------------------------------------
+    // Tone recorder
+    //------------------------------------------------------------
+    struct Tone {
+        uint64_t at_ms;
+        uint8_t pin;
+        unsigned int freq;      // 0 for noTone()
+        unsigned long dur;
+    };
+
+    const std::vector<Tone>& tones();
+    void clear_tones();
+
+    //------------------------------------------------------------
+    // Waveform output
+    //------------------------------------------------------------
+    // The firmware's audio engine reports the notes it starts (0 when it
+    // falls silent), they are recorded among the tones. Its sample interrupt
+    // passes every PWM duty value it produces
+    void audio_note(uint8_t pin, unsigned int freq);
+    void audio_sample(uint8_t pin, uint8_t duty);
+    uint32_t audio_samples();
+
+} // end of hal namespace
+
+#endif // __HOST_HAL_H_
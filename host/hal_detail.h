@@ -0,0 +1,27 @@
+/*
+* Private glue between the simulated devices of the host HAL
+*/
+
+#ifndef __HOST_HAL_DETAIL_H_
+#define __HOST_HAL_DETAIL_H_
+
+#include <stdint.h>
+
+namespace hal {
+    namespace detail {
+        void reset_eeprom();
+        void reset_lcd();
+
+        // digitalWrite() notification for the LCD bus model
+        void lcd_pin(uint8_t pin, uint8_t val);
+
+        // Heap allocations made by the HAL while an Untracked object lives
+        // are not counted in hal::heap_allocs()
+        struct Untracked {
+            Untracked();
+            ~Untracked();
+        };
+    }
+}
+
+#endif // __HOST_HAL_DETAIL_H_
@@ -0,0 +1,103 @@
+/*
+* Global operator new/delete replacement which counts the heap allocations
+* made by the firmware. Allocations of the simulated devices themselves are
+* done under hal::detail::Untracked and don't show up in the counter
+*/
+
+#include "hal.h"
+#include "hal_detail.h"
+
+#include <new>
+#include <stdlib.h>
+
+
+namespace {
+
+    uint32_t allocs = 0;
+    uint64_t alloc_bytes = 0;
+    uint32_t untracked = 0;
+
+    void* allocate(size_t size)
+    {
+        if (untracked == 0) {
+            allocs++;
+            alloc_bytes += size;
+        }
+
+        void *p = malloc(size ? size : 1);
+        if (p == NULL)
+            throw std::bad_alloc();
+
+        return p;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+void* operator new(size_t size)
+{
+    return allocate(size);
+}
+
+
+//------------------------------------------------------------------------------------------
+void* operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+
+//------------------------------------------------------------------------------------------
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+void operator delete[](void *p) noexcept
+{
+    free(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+void operator delete[](void *p, size_t) noexcept
+{
+    free(p);
+}
+
+
+//------------------------------------------------------------------------------------------
+hal::detail::Untracked::Untracked()
+{
+    untracked++;
+}
+
+
+//------------------------------------------------------------------------------------------
+hal::detail::Untracked::~Untracked()
+{
+    untracked--;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t hal::heap_allocs()
+{
+    return allocs;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint64_t hal::heap_alloc_bytes()
+{
+    return alloc_bytes;
+}
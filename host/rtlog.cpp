@@ -0,0 +1,146 @@
+/*
+* rtlog - decodes the event log of the rtimer firmware to CSV.
+*
+*   rtlog < dump.txt > log.csv
+*
+* The input is the text RTimer::dump_log() or dump_saved_log() writes to the
+* serial port: a "log,<ms>" line and the bytes of the log in hex below it.
+* Other lines are skipped, so a whole serial capture (or the output of
+* rtsim log) will do. Every log found becomes the CSV lines
+*
+*   ms,event,timer,what,value
+*
+* ms is the time since the timer's power on. The saved log starts with a
+* mark of its time, the events of a record whose mark was written over are
+* counted from 0
+*/
+
+#include "rt_log.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+    // Names of the values of the firmware's enums in their order
+    const char *const STATES[] = {
+        "NOT STARTED", "START CNTDWN", "STARTED", "DELAYED", "T.PAUSED", "D.PAUSED"
+    };
+    const char *const BEEPS[] = {"start", "delay", "start cntdwn", "end cntdwn", "end"};
+    const char *const KINDS[] = {"work", "rest", "warm-up", "break", "cool-down"};
+    const char *const KEYS[] = {"NONE", "SELECT", "LEFT", "UP", "DOWN", "RIGHT"};
+    const char *const MODES[] = {"single", "long", "double"};
+
+    template <size_t N>
+    std::string name(const char *const (&names)[N], unsigned v)
+    {
+        if (v < N)
+            return names[v];
+
+        char num[8];
+        snprintf(num, sizeof(num), "%u", v);
+
+        return num;
+    }
+
+    bool hex_line(const std::string &line)
+    {
+        if (line.empty() || line.size() % 2 != 0)
+            return false;
+        for (size_t i = 0; i < line.size(); i++)
+            if (!isxdigit((unsigned char)line[i]))
+                return false;
+
+        return true;
+    }
+
+    void print_csv(const std::vector<uint8_t> &data, uint32_t base)
+    {
+        rtimer::EventLog::Event e;
+        e.at = base;
+        uint16_t pos = 0;
+        while (rtimer::EventLog::decode(data.data(), uint16_t(data.size()), pos, e)) {
+            unsigned timer = e.arg >> 3,
+                     low = e.arg & 7;
+            switch (e.type) {
+                case rtimer::EventLog::evKey:
+                    printf("%u,key,,%s,%s\n", e.at, name(KEYS, e.value).c_str(),
+                           name(MODES, e.arg).c_str());
+                    break;
+
+                case rtimer::EventLog::evBeep:
+                    printf("%u,beep,%u,%s,\n", e.at, timer + 1, name(BEEPS, low).c_str());
+                    break;
+
+                case rtimer::EventLog::evState:
+                    printf("%u,state,%u,%s,\n", e.at, timer + 1, name(STATES, low).c_str());
+                    break;
+
+                case rtimer::EventLog::evPhase:
+                    printf("%u,phase,%u,%s,%u\n", e.at, timer + 1, name(KINDS, low).c_str(),
+                           e.value);
+                    break;
+
+                case rtimer::EventLog::evMark:
+                    printf("%u,mark,,,\n", e.at);
+                    break;
+
+                default:
+                    printf("%u,unknown,,%u,\n", e.at, e.arg);
+                    break;
+            }
+        }
+        if (pos < data.size())
+            fprintf(stderr, "rtlog: the log is cut short %u bytes before its end\n",
+                    unsigned(data.size() - pos));
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+int main()
+{
+    std::vector<uint8_t> data;
+    uint32_t base = 0;
+    bool in_log = false;
+    int logs = 0;
+    char buf[512];
+
+    printf("ms,event,timer,what,value\n");
+    while (fgets(buf, sizeof(buf), stdin) != NULL) {
+        std::string line(buf);
+        while (!line.empty() && isspace((unsigned char)line[line.size() - 1]))
+            line.erase(line.size() - 1);
+
+        if (in_log && hex_line(line)) {
+            for (size_t i = 0; i < line.size(); i += 2)
+                data.push_back(uint8_t(strtoul(line.substr(i, 2).c_str(), NULL, 16)));
+            continue;
+        }
+        if (in_log) {
+            print_csv(data, base);
+            in_log = false;
+        }
+
+        unsigned long ms;
+        if (sscanf(line.c_str(), "log,%lu", &ms) == 1) {
+            base = uint32_t(ms);
+            data.clear();
+            in_log = true;
+            logs++;
+        }
+    }
+    if (in_log)
+        print_csv(data, base);
+
+    if (logs == 0) {
+        fprintf(stderr, "rtlog: no log in the input\n");
+        return 1;
+    }
+
+    return 0;
+}
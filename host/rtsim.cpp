@@ -0,0 +1,1807 @@
+/*
+* rtsim - runs the real rtimer firmware against the simulated hardware.
+*
+*   rtsim session [-n N] [-seed S] [-rounds R] [-pause AT:LEN]
+*                 [-realtime [-loop US] | -tickless]
+*       play N scripted timer sessions of R rounds and report them. With -pause
+*       the timer is paused AT ms after its start for LEN ms
+*   rtsim bench [-n N]
+*       measure the host cost of a single RTimer::run() pass and of an audio sample
+*   rtsim edit [-n N] [-idle MS] [-hold MS]
+*       step the timer minimum N times (20 by default) on its settings page and
+*       leave it, then report the key handling latency and the EEPROM writes.
+*       -idle sets the time without edits before the settings are written.
+*       -hold holds UP for MS instead and shows the value the auto-repeat reached
+*   rtsim wear [-n N]
+*       make N settings edits (100000 by default) and report the EEPROM writes
+*       per cell of the settings store against the fixed layout it replaced
+*   rtsim keys [-n N] [-seed S]
+*       measure the cost of decoding a key from an ADC sample, then calibrate the
+*       keys of N shields of each kind on their settings page and count the
+*       noisy samples decoded wrong with the default and the learned thresholds
+*   rtsim debounce [-n N] [-seed S]
+*       press random keys N times (200 by default) on clean, noisy, glitchy and
+*       bouncing inputs and compare the press and release latency and the false
+*       events of the keyboard's debounce with the 20 ms one it replaced
+*   rtsim keypad [-n N] [-seed S]
+*       press the shield's ladder, a 4x4 matrix and two buttons two at a time
+*       N times (200 by default) and check the merged events of every source
+*   rtsim rand [-n N] [-seed S]
+*       measure a random interval against random(), run the chi-square test of
+*       N draws (1000000 by default) of every distribution and count the seeds
+*       of noisy power-ons
+*   rtsim plan [-n N] [-seed S] [-rounds R]
+*       play N sessions (20 by default) of R rounds (10 by default), check the
+*       beeps against the dumped plan and replay every session from its seed
+*   rtsim timers [-n N] [-seed S] [-rounds R]
+*       measure the timing wheel against a scan of the deadlines, then run the
+*       timers at once N times (5 by default) with different settings
+*       and check the beeps of every timer against its plan
+*   rtsim prog [-n N] [-seed S] [-rounds R]
+*       measure the interpreter and the bytes per phase of every interval
+*       program, then play the programs of the flash and the one of R rounds
+*       N times (3 by default) and check the beeps against their plans
+*   rtsim log [-n N] [-seed S] [-rounds R]
+*       measure the cost of logging an event, then play N sessions (10 by
+*       default) of R rounds with a pause, check the event log against the
+*       beeps and the plan and the saved log after a power cycle. The first
+*       logs are printed for rtlog
+*
+* By default the clock jumps straight to the next deadline of the firmware or
+* to the next scripted key change, so a session costs only the passes in which
+* something happens. -realtime steps the clock the way the board's loop does,
+* by US microseconds per pass on top of the simulated I/O (100 by default).
+* -tickless runs the loop of the sketch: run() and then RTimer::sleep() until
+* an interrupt brings something to do
+*/
+
+#include "rt.h"
+#include "hal.h"
+
+#include <EEPROM.h>
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace {
+
+    // ADC levels of the shield's keys
+    const uint16_t
+        ADC_RIGHT = 0,
+        ADC_UP = 100,
+        ADC_DOWN = 256,
+        ADC_LEFT = 408,
+        ADC_SELECT = 640,
+        ADC_NONE = 1023;
+
+    // time the board spends in a loop() pass besides the simulated I/O
+    const uint64_t LOOP_US = 100;
+
+    struct Options {
+        int n;
+        unsigned long seed;
+        int rounds;
+        bool realtime;
+        bool tickless;
+        uint64_t loop_us;
+        uint64_t pause_at;
+        uint64_t pause_len;
+        long idle_ms;
+        uint64_t hold_ms;
+    };
+
+    // longest possible session: 50 rounds of 180 s work and 60 s delay
+    const uint64_t SESSION_LIMIT_MS = 50ULL * (180 + 60) * 1000 + 60000;
+
+    // step of the clock while only the interrupts have work (e.g. a beep pattern)
+    const uint64_t IDLE_STEP_MS = 1000;
+
+    typedef std::chrono::steady_clock HostClock;
+
+    //--------------------------------------------------------------------------------------
+    // The board: RTimer lives in zeroed storage just as the global object of the sketch does
+    class Board {
+        public:
+            Board() : rtm(NULL) {}
+            ~Board() { power_off(); }
+
+            rtimer::RTimer& power_on() {
+                power_off();
+                memset(mem, 0, sizeof(mem));
+                rtm = new (mem) rtimer::RTimer(rtimer::lcp, keys::P_KEYBOARD, rtimer::P_BEEPER);
+                rtm->begin();
+
+                return *rtm;
+            }
+
+            void power_off() {
+                if (rtm != NULL)
+                    rtm->~RTimer();
+                rtm = NULL;
+            }
+
+            rtimer::RTimer& get() { return *rtm; }
+
+        private:
+            alignas(rtimer::RTimer) unsigned char mem[sizeof(rtimer::RTimer)];
+            rtimer::RTimer *rtm;
+    };
+
+    //--------------------------------------------------------------------------------------
+    void press(uint64_t at_ms, uint16_t level, uint64_t hold_ms)
+    {
+        hal::adc_push(keys::P_KEYBOARD, at_ms, level);
+        hal::adc_push(keys::P_KEYBOARD, at_ms + hold_ms, ADC_NONE);
+    }
+
+    // Looks for the end beep among the new tones and returns its time in at_ms
+    bool ended(size_t &seen, uint64_t &at_ms)
+    {
+        const std::vector<hal::Tone> &tones = hal::tones();
+        for (; seen < tones.size(); seen++)
+            if (tones[seen].freq == 100) {
+                at_ms = tones[seen].at_ms;
+                return true;
+            }
+
+        return false;
+    }
+
+    // Settings payload of RTimer::save() with the given number of rounds
+    void make_settings(uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE], uint8_t rounds)
+    {
+        const uint8_t def[rtimer::ConfigStore::PAYLOAD_SIZE] =
+            {1, 30, 180, 1, 1, 60, 2, rounds, 1, 1, rtimer::DISPLAY_BKLIT};
+
+        memcpy(cfg, def, sizeof(def));
+    }
+
+    // Put the settings into the EEPROM before the board is powered on
+    void preset(const uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE])
+    {
+        rtimer::ConfigStore store;
+        store.save(cfg);
+    }
+
+    void preset_rounds(uint8_t rounds)
+    {
+        uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE];
+        make_settings(cfg, rounds);
+        preset(cfg);
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Virtual-time driver: move the clock to the next moment run() has any work
+    void step(rtimer::RTimer &rtm, const Options &opt)
+    {
+        if (opt.realtime) {
+            hal::advance_us(opt.loop_us);
+            return;
+        }
+        if (opt.tickless) {
+            // the interrupts go on playing the beeps after the firmware has
+            // nothing left to do, so the sleep is bounded to see them
+            rtm.sleep(IDLE_STEP_MS);
+            return;
+        }
+
+        // a key change the ADC hasn't sampled yet is due as well, otherwise
+        // the clock would jump over a held key straight to its release
+        uint64_t now = hal::now_us() / 1000,
+                 next = rtm.next_deadline(),
+                 key = hal::adc_next_change(now > 0 ? now - 1 : 0);
+        if (next == keys::NO_DEADLINE)
+            next = UINT64_MAX;
+        if (key < next)
+            next = key;
+
+        // a due deadline the firmware couldn't serve yet (e.g. a held key) is retried a ms later
+        if (next <= now)
+            next = now + 1;
+        if (next == UINT64_MAX)
+            next = now + IDLE_STEP_MS;
+
+        hal::set_us(next * 1000);
+    }
+
+    struct SessionResult {
+        bool finished;
+        uint64_t virtual_ms;
+        uint64_t passes;
+        size_t beeps;
+        uint32_t allocs;    // heap allocations made inside run()
+        rtimer::RTimer::Stats stats;
+        rtimer::Scheduler::TaskStats tasks[rtimer::Scheduler::MAX_TASKS];
+        uint8_t task_count;
+    };
+
+    //--------------------------------------------------------------------------------------
+    // Enter the timer page, start it and let the session run until the end beep.
+    // The settings are cfg if given, otherwise the defaults with opt.rounds
+    SessionResult play_session(Board &board, const Options &opt, unsigned long seed,
+                               const uint8_t *cfg = NULL)
+    {
+        board.power_off();
+        hal::reset();
+        hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+        if (cfg != NULL)
+            preset(cfg);
+        else if (opt.rounds > 0)
+            preset_rounds(uint8_t(opt.rounds));
+        rtimer::RTimer &rtm = board.power_on();
+        rtm.seed_random(seed);
+
+        uint64_t start = hal::now_us() / 1000;
+        press(start + 100, ADC_SELECT, 100);
+        press(start + 600, ADC_SELECT, 100);
+        if (opt.pause_len > 0) {
+            press(start + 600 + opt.pause_at, ADC_RIGHT, 100);
+            press(start + 600 + opt.pause_at + opt.pause_len, ADC_RIGHT, 100);
+        }
+
+        SessionResult res = SessionResult();
+        size_t seen = 0;
+        uint64_t end_ms = 0;
+        while (hal::now_us() / 1000 - start < SESSION_LIMIT_MS) {
+            uint32_t allocs = hal::heap_allocs();
+            rtm.run();
+            res.allocs += hal::heap_allocs() - allocs;
+            res.passes++;
+            if (ended(seen, end_ms)) {
+                res.finished = true;
+                break;
+            }
+            step(rtm, opt);
+        }
+        // the end beep is played by the tick interrupt after the last pass
+        if (!res.finished)
+            res.finished = ended(seen, end_ms);
+        res.virtual_ms = (res.finished ? end_ms : hal::now_us() / 1000) - start;
+        res.stats = rtm.get_stats();
+        res.task_count = rtm.get_scheduler().size();
+        for (uint8_t i = 0; i < res.task_count; i++)
+            res.tasks[i] = rtm.get_scheduler().get_stats(i);
+        for (size_t i = 0; i < hal::tones().size(); i++)
+            if (hal::tones()[i].freq != 0)
+                res.beeps++;
+
+        return res;
+    }
+
+    //--------------------------------------------------------------------------------------
+    int cmd_session(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 1;
+        Board board;
+        uint64_t virtual_ms = 0,
+                 passes = 0,
+                 allocs = 0;
+        int failed = 0;
+
+        HostClock::time_point t0 = HostClock::now();
+        for (int i = 0; i < n; i++) {
+            SessionResult r = play_session(board, opt, opt.seed + i);
+            if (!r.finished)
+                failed++;
+            virtual_ms += r.virtual_ms;
+            passes += r.passes;
+            allocs += r.allocs;
+            if (n == 1)
+                printf("session: %s in %llu ms, %llu passes, %zu beeps\n"
+                       "lcd: %u data writes, %u commands, %llu us busy\n"
+                       "renderer: %u characters, %u cursor moves, queue max %u, %u overflows\n"
+                       "timer ticks: %u ms late now, %u ms at worst\n"
+                       "duty cycle: %u ms awake, %u ms asleep\n"
+                       "beeper: %u patterns dropped\n"
+                       "settings: %u records written\n"
+                       "adc reads: %u, eeprom writes: %u, audio samples: %u\n",
+                       r.finished ? "finished" : "NOT finished",
+                       (unsigned long long)r.virtual_ms, (unsigned long long)r.passes, r.beeps,
+                       hal::lcd_data_writes(), hal::lcd_commands(),
+                       (unsigned long long)hal::lcd_busy_us(),
+                       r.stats.lcd_writes, r.stats.lcd_moves,
+                       r.stats.lcd_queue_max, r.stats.lcd_overflows,
+                       r.stats.tick_drift, r.stats.tick_drift_max,
+                       r.stats.awake_ms, r.stats.asleep_ms,
+                       r.stats.beeps_lost,
+                       r.stats.cfg_writes,
+                       hal::adc_reads(), hal::eeprom_total_writes(), hal::audio_samples());
+            if (n == 1) {
+                printf("task      runs   wcet us  budget us  overruns\n");
+                for (uint8_t t = 0; t < r.task_count; t++)
+                    printf("%-8s %6u %9u %10u %9u\n", r.tasks[t].name, r.tasks[t].runs,
+                           r.tasks[t].wcet_us, r.tasks[t].budget_us, r.tasks[t].overruns);
+                printf("screen: [%s]\n        [%s]\n",
+                       hal::lcd_line(0).c_str(), hal::lcd_line(1).c_str());
+            }
+        }
+        double host_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+
+        printf("%d sessions, %d unfinished, %.1f s simulated in %.3f s host (%.1f sessions/s)\n",
+               n, failed, virtual_ms / 1000.0, host_s, n / host_s);
+        printf("%.1f ns per run() pass\n", passes ? host_s * 1e9 / passes : 0.0);
+        printf("%llu heap allocations in run()\n", (unsigned long long)allocs);
+
+        // the main loop must not touch the heap at all
+        return failed == 0 && allocs == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Host cost of run() on an idle menu and on a running timer page
+    int cmd_bench(int n)
+    {
+        Board board;
+
+        hal::reset();
+        hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+        rtimer::RTimer &rtm = board.power_on();
+
+        HostClock::time_point t0 = HostClock::now();
+        for (int i = 0; i < n; i++) {
+            rtm.run();
+            hal::advance_us(LOOP_US);
+        }
+        double menu_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+
+        uint64_t now = hal::now_us() / 1000;
+        press(now + 10, ADC_SELECT, 100);
+        press(now + 500, ADC_SELECT, 100);
+        while (hal::now_us() / 1000 < now + 700) {
+            rtm.run();
+            hal::advance_us(LOOP_US);
+        }
+
+        t0 = HostClock::now();
+        for (int i = 0; i < n; i++) {
+            rtm.run();
+            hal::advance_us(LOOP_US);
+        }
+        double timer_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+
+        printf("RTimer:     %zu bytes of RAM in the host layout\n", sizeof(rtimer::RTimer));
+        printf("menu page:  %.1f ns per run() pass\n", menu_s * 1e9 / n);
+        printf("timer page: %.1f ns per run() pass\n", timer_s * 1e9 / n);
+
+        // the sample interrupt runs 15625 times a second while a beep plays
+        rtimer::audio::play(1000, rtimer::audio::wSine);
+        rtimer::audio::set_level(255);
+        volatile uint8_t duty = 0;
+        t0 = HostClock::now();
+        for (int i = 0; i < n; i++)
+            duty = rtimer::audio::next_sample();
+        double sample_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        rtimer::audio::silence();
+
+        (void)duty;
+
+        printf("audio:      %.1f ns per sample\n", sample_s * 1e9 / n);
+
+        return 0;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Settings editing: MAIN MENU > SETTINGS > SET>TMR, UP n times or held, LEFT
+    int cmd_edit(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 20;
+        Board board;
+
+        hal::reset();
+        hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+        rtimer::RTimer &rtm = board.power_on();
+        if (opt.idle_ms >= 0)
+            rtm.set_save_idle(uint16_t(opt.idle_ms));
+        uint32_t eeprom_at_start = hal::eeprom_total_writes();
+
+        // presses are kept apart enough not to make double clicks
+        uint64_t t = hal::now_us() / 1000 + 100;
+        press(t, ADC_DOWN, 100);
+        press(t += 400, ADC_SELECT, 100);
+        press(t += 400, ADC_SELECT, 100);
+        if (opt.hold_ms > 0) {
+            press(t += 400, ADC_UP, opt.hold_ms);
+            t += opt.hold_ms;
+        }
+        else
+            for (int i = 0; i < n; i++)
+                press(t += 400, ADC_UP, 100);
+        press(t += 400, ADC_LEFT, 100);
+        uint64_t left_at = t,
+                 end = t + 10000;
+        std::string edited;
+
+        // the longest run() pass is how long the keys could wait for the loop
+        uint64_t longest = 0;
+        while (hal::now_us() / 1000 < end) {
+            if (edited.empty() && hal::now_us() / 1000 >= left_at)
+                edited = hal::lcd_line(1);
+            uint64_t start = hal::now_us();
+            rtm.run();
+            if (hal::now_us() - start > longest)
+                longest = hal::now_us() - start;
+            step(rtm, opt);
+        }
+
+        rtimer::RTimer::Stats st = rtm.get_stats();
+        if (opt.hold_ms > 0) {
+            uint32_t events = 0;
+            for (uint8_t b = 0; b < rtimer::LATENCY_BUCKETS; b++)
+                events += st.key_latency[b];
+            printf("UP held %llu ms: [%s], %u key events\n",
+                   (unsigned long long)opt.hold_ms, edited.c_str(), events);
+        }
+        else
+            printf("%d edits, ", n);
+        printf("%u settings records, %u eeprom writes, %u bytes left dirty\n",
+               st.cfg_writes, hal::eeprom_total_writes() - eeprom_at_start, st.cfg_dirty);
+        printf("longest run() pass: %llu us\n", (unsigned long long)longest);
+        printf("settings key handling:\n");
+        for (uint8_t b = 0; b < rtimer::LATENCY_BUCKETS; b++)
+            if (b < rtimer::LATENCY_BUCKETS - 1)
+                printf("  < %5lu us: %u\n", 256UL << b, st.key_latency[b]);
+            else
+                printf("  >=%5lu us: %u\n", 256UL << (b - 1), st.key_latency[b]);
+        printf("screen: [%s]\n        [%s]\n", hal::lcd_line(0).c_str(), hal::lcd_line(1).c_str());
+
+        return st.cfg_dirty == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Busiest cell and the average over the cells which were written at all
+    void cell_wear(const char *name, uint32_t edits)
+    {
+        uint32_t max = 0,
+                 used = 0;
+        uint64_t sum = 0;
+        for (uint16_t i = 0; i < hal::EEPROM_SIZE; i++) {
+            uint32_t w = hal::eeprom_writes(i);
+            if (w > max)
+                max = w;
+            if (w > 0)
+                used++;
+            sum += w;
+        }
+
+        // an AVR EEPROM cell is good for 100000 erase/write cycles
+        printf("%-12s %8u %8.1f %6u %14.0f\n", name, max, used ? double(sum) / used : 0.0, used,
+               max ? 100000.0 * edits / max : 0.0);
+    }
+
+    // A settings edit as the UP/DOWN keys make it: the timer minimum goes up
+    // and down over its range
+    uint8_t edit_value(uint32_t i)
+    {
+        uint32_t span = rtimer::TIMER_MAX_DEFAULT - rtimer::TIMER_MIN_DEFAULT,
+                 k = i % (2 * span);
+
+        return rtimer::TIMER_MIN_DEFAULT + (k < span ? k + 1 : 2 * span - k - 1);
+    }
+
+    int cmd_wear(uint32_t edits)
+    {
+        uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE];
+
+        printf("%u edits\n", edits);
+        printf("layout       max/cell mean/cell  cells  edits to 100k\n");
+
+        // the fixed layout: magic at 0 and a field per address behind it
+        hal::reset();
+        make_settings(cfg, 1);
+        EEPROM.update(0, 73);
+        for (uint8_t i = 0; i < sizeof(cfg); i++)
+            EEPROM.update(i + 1, cfg[i]);
+        for (uint32_t i = 0; i < edits; i++)
+            EEPROM.update(2, edit_value(i));
+        cell_wear("fixed", edits);
+
+        // the log layout: the firmware's settings slots, the rest of the
+        // EEPROM belongs to the event log, the timers and the keyboard
+        hal::reset();
+        make_settings(cfg, 1);
+        rtimer::ConfigStore store(rtimer::ConfigStore::VERSION, rtimer::SETTINGS_FIRST,
+                                  rtimer::SETTINGS_SLOTS);
+        store.save(cfg);
+        for (uint32_t i = 0; i < edits; i++) {
+            cfg[1] = edit_value(i);
+            store.save(cfg);
+        }
+        cell_wear("log", edits);
+
+        // tear the newest record: a fresh store has to fall back to the previous one.
+        // The records go round the slots from the first one, the 16-bit seq
+        // wraps out of step with them
+        uint16_t addr = uint16_t(rtimer::SETTINGS_FIRST + (store.get_writes() - 1) % rtimer::SETTINGS_SLOTS) *
+                        rtimer::ConfigStore::RECORD_SIZE;
+        hal::eeprom_poke(addr + 4, hal::eeprom_peek(addr + 4) ^ 0x5A);
+        rtimer::ConfigStore reloaded(rtimer::ConfigStore::VERSION, rtimer::SETTINGS_FIRST,
+                                     rtimer::SETTINGS_SLOTS);
+        bool ok = reloaded.load(cfg) && reloaded.get_seq() == store.get_seq() - 1 &&
+                  cfg[1] == edit_value(edits - 2);
+        printf("%u records written, torn record %s\n", store.get_writes(),
+               ok ? "skipped" : "NOT skipped");
+
+        return ok ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Keyboard decoding on shields whose ladders differ from the nominal one
+
+    // ADC levels of a shield's keys in the ladder order: RIGHT, UP, DOWN, LEFT, SELECT
+    struct Shield {
+        const char *name;
+        uint16_t levels[keys::LADDER_KEYS];
+    };
+
+    const Shield SHIELDS[] = {
+        {"v1.0", {0, 100, 256, 408, 640}},
+        {"v1.1", {0, 144, 329, 504, 741}}
+    };
+
+    const keys::KeyCode LADDER[keys::LADDER_KEYS] =
+        {keys::kcRight, keys::kcUp, keys::kcDown, keys::kcLeft, keys::kcSelect};
+
+    // resistor tolerance of a single shield and the ADC noise
+    const double KEY_TOLERANCE = 0.05,
+                 ADC_SIGMA = 6.0;
+
+    const uint32_t SAMPLES_PER_KEY = 20000;
+
+    uint16_t noisy(std::mt19937 &rng, uint16_t level)
+    {
+        std::normal_distribution<double> noise(0.0, ADC_SIGMA);
+        long v = lround(level + noise(rng));
+
+        return uint16_t(v < 0 ? 0 : v > 1023 ? 1023 : v);
+    }
+
+    // A press of the key with a new noisy sample every ms
+    void press_noisy(std::mt19937 &rng, uint64_t at_ms, uint16_t level, uint64_t hold_ms)
+    {
+        for (uint64_t ms = 0; ms < hold_ms; ms++)
+            hal::adc_push(keys::P_KEYBOARD, at_ms + ms, noisy(rng, level));
+        hal::adc_push(keys::P_KEYBOARD, at_ms + hold_ms, ADC_NONE);
+    }
+
+    // The key the ladder walk of the older firmware finds, the reference for the table
+    keys::KeyCode decode_linear(const uint16_t th[keys::LADDER_KEYS], uint16_t adc)
+    {
+        for (uint8_t i = 0; i < keys::LADDER_KEYS; i++)
+            if (adc < th[i])
+                return LADDER[i];
+
+        return keys::kcNone;
+    }
+
+    // Calibrates the keys on the SET>KEYS page of the firmware and returns the
+    // thresholds it stored, false if the page didn't report success
+    bool calibrate_board(Board &board, const Options &opt, std::mt19937 &rng,
+                         const uint16_t levels[keys::LADDER_KEYS], uint16_t th[keys::LADDER_KEYS])
+    {
+        board.power_off();
+        hal::reset();
+        hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+        rtimer::RTimer &rtm = board.power_on();
+
+        // MAIN MENU > SETTINGS > SET>KEYS with the nominal levels of the shield
+        uint64_t t = hal::now_us() / 1000 + 100;
+        press(t, levels[2], 100);
+        press(t += 400, levels[4], 100);
+        for (int i = 0; i < 5; i++)
+            press(t += 400, levels[2], 100);
+        press(t += 400, levels[4], 100);
+        // the keys as the page asks for them, SELECT to RIGHT
+        for (int code = keys::kcSelect; code <= keys::kcRight; code++)
+            for (uint8_t i = 0; i < keys::LADDER_KEYS; i++)
+                if (LADDER[i] == code)
+                    press_noisy(rng, t += 400, levels[i], 200);
+        uint64_t end = t + 1000;
+
+        while (hal::now_us() / 1000 < end) {
+            rtm.run();
+            step(rtm, opt);
+        }
+        if (hal::lcd_line(0).compare(0, 15, "KEYS CALIBRATED") != 0)
+            return false;
+
+        uint8_t rec[rtimer::ConfigStore::PAYLOAD_SIZE];
+        rtimer::ConfigStore cal(rtimer::KEYS_RECORD, rtimer::KEYS_FIRST, rtimer::KEYS_SLOTS);
+        if (!cal.load(rec))
+            return false;
+        for (uint8_t i = 0; i < keys::LADDER_KEYS; i++)
+            th[i] = rec[2 * i] | uint16_t(rec[2 * i + 1]) << 8;
+
+        return true;
+    }
+
+    int cmd_keys(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 10;
+        std::mt19937 rng(opt.seed);
+        keys::Keyboard kbd(keys::P_KEYBOARD);
+
+        // decoding cost over a trace of noisy key levels
+        std::vector<uint16_t> trace(4096);
+        for (size_t i = 0; i < trace.size(); i++)
+            trace[i] = noisy(rng, SHIELDS[0].levels[i % keys::LADDER_KEYS]);
+        const uint32_t decodes = 20000000;
+        volatile uint8_t sink = 0;
+        HostClock::time_point t0 = HostClock::now();
+        for (uint32_t i = 0; i < decodes; i++)
+            sink = sink + kbd.decode(trace[i & 4095]);
+        double lut_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        t0 = HostClock::now();
+        for (uint32_t i = 0; i < decodes; i++)
+            sink = sink + decode_linear(keys::DEFAULT_THRESHOLDS, trace[i & 4095]);
+        double linear_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        printf("decode: table %.2f ns, ladder walk %.2f ns per sample\n",
+               lut_s * 1e9 / decodes, linear_s * 1e9 / decodes);
+
+        printf("%d shields of each kind, keys off by up to %.0f%%, ADC noise sigma %.0f\n",
+               n, KEY_TOLERANCE * 100, ADC_SIGMA);
+        printf("shield  misread: default    calibrated  failed\n");
+        Board board;
+        int failures = 0;
+        for (size_t s = 0; s < sizeof(SHIELDS) / sizeof(SHIELDS[0]); s++) {
+            uint64_t samples = 0,
+                     wrong_def = 0,
+                     wrong_cal = 0;
+            int failed = 0;
+            for (int i = 0; i < n; i++) {
+                std::uniform_real_distribution<double> off(-KEY_TOLERANCE, KEY_TOLERANCE);
+                uint16_t levels[keys::LADDER_KEYS];
+                for (uint8_t k = 0; k < keys::LADDER_KEYS; k++)
+                    levels[k] = uint16_t(lround(SHIELDS[s].levels[k] * (1.0 + off(rng))));
+
+                uint16_t th[keys::LADDER_KEYS];
+                bool ok = calibrate_board(board, opt, rng, levels, th) && kbd.set_thresholds(th);
+                if (!ok)
+                    failed++;
+
+                for (uint8_t k = 0; k < keys::LADDER_KEYS; k++)
+                    for (uint32_t j = 0; j < SAMPLES_PER_KEY; j++) {
+                        uint16_t adc = noisy(rng, levels[k]);
+                        samples++;
+                        if (decode_linear(keys::DEFAULT_THRESHOLDS, adc) != LADDER[k])
+                            wrong_def++;
+                        if (!ok || kbd.decode(adc) != LADDER[k])
+                            wrong_cal++;
+                    }
+            }
+            printf("%-6s           %6.3f%%     %6.3f%%  %6d\n", SHIELDS[s].name,
+                   100.0 * wrong_def / samples, 100.0 * wrong_cal / samples, failed);
+            failures += failed;
+        }
+        (void)sink;
+
+        return failures == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Debounce: press and release latency and false events of the keyboard
+    // against the 20 ms single sample debounce it replaced
+
+    struct DebounceRun {
+        uint64_t press_ms;
+        uint64_t release_ms;
+        keys::KeyCode key;
+        std::vector<keys::KeyEvent> events;
+    };
+
+    // the older firmware: a change is taken once no other one was seen for 20 ms
+    keys::Keyboard *legacy_kbd = NULL;
+    keys::KeyCode legacy_key;
+    unsigned long legacy_time;
+    std::vector<keys::KeyEvent> *legacy_events = NULL;
+
+    void legacy_isr()
+    {
+        keys::KeyCode key = legacy_kbd->decode(analogRead(keys::P_KEYBOARD));
+        unsigned long now = millis();
+        if (key != legacy_key && now - legacy_time < keys::DEBOUNCE_TOUT)
+            return;
+        legacy_time = now;
+        if (key == legacy_key)
+            return;
+
+        legacy_key = key;
+        keys::KeyEvent ev = {{key, keys::kmSingle, 0}, now};
+        legacy_events->push_back(ev);
+    }
+
+    struct Latency {
+        uint64_t press_sum, press_max, release_sum, release_max, missed, false_events;
+        uint32_t runs;
+    };
+
+    void account(Latency &l, const DebounceRun &r)
+    {
+        bool pressed = false,
+             released = false;
+        l.runs++;
+        for (size_t i = 0; i < r.events.size(); i++) {
+            const keys::KeyEvent &ev = r.events[i];
+            if (!pressed && ev.key.code == r.key && ev.time >= r.press_ms) {
+                pressed = true;
+                l.press_sum += ev.time - r.press_ms;
+                if (ev.time - r.press_ms > l.press_max)
+                    l.press_max = ev.time - r.press_ms;
+            }
+            else if (pressed && !released && ev.key.code == keys::kcNone && ev.time >= r.release_ms) {
+                released = true;
+                l.release_sum += ev.time - r.release_ms;
+                if (ev.time - r.release_ms > l.release_max)
+                    l.release_max = ev.time - r.release_ms;
+            }
+            else
+                l.false_events++;
+        }
+        if (!pressed || !released)
+            l.missed++;
+    }
+
+    void print_latency(const char *input, const char *algo, const Latency &l)
+    {
+        uint32_t seen = l.runs - uint32_t(l.missed);
+        printf("%-8s %-9s %6.1f %4llu   %6.1f %4llu   %6.3f  %4llu\n", input, algo,
+               seen ? double(l.press_sum) / seen : 0.0, (unsigned long long)l.press_max,
+               seen ? double(l.release_sum) / seen : 0.0, (unsigned long long)l.release_max,
+               double(l.false_events) / l.runs, (unsigned long long)l.missed);
+    }
+
+    int cmd_debounce(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 200;
+        const struct {
+            const char *name;
+            double sigma;
+            double glitch;
+            uint8_t bounce_ms;  // contact bounce at the press and the release
+        } INPUTS[] = {
+            {"clean", 0, 0, 0},
+            {"noisy", 6, 0.01, 0},
+            {"glitchy", 6, 0.05, 0},
+            {"bouncy", 6, 0.01, 4}
+        };
+
+        printf("%d presses of 150 ms per input, samples every %u us\n", n, keys::SAMPLE_US);
+        printf("input    debounce  press ms       release ms     false   missed\n");
+        printf("                   mean  max      mean  max      /press\n");
+        std::mt19937 rng(opt.seed);
+        bool ok = true;
+        for (size_t in = 0; in < sizeof(INPUTS) / sizeof(INPUTS[0]); in++) {
+            hal::reset();
+            hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+            hal::adc_noise(keys::P_KEYBOARD, INPUTS[in].sigma, INPUTS[in].glitch, opt.seed);
+
+            keys::Keyboard kbd(keys::P_KEYBOARD);
+            kbd.begin_sampling();
+            legacy_kbd = &kbd;
+            legacy_key = keys::kcNone;
+            legacy_time = 0;
+            std::vector<keys::KeyEvent> legacy;
+            legacy_events = &legacy;
+            hal::attach_isr(legacy_isr, keys::SAMPLE_US);
+
+            Latency now_l = Latency(),
+                    old_l = Latency();
+            for (int i = 0; i < n; i++) {
+                DebounceRun run;
+                run.key = LADDER[rng() % keys::LADDER_KEYS];
+                uint16_t level = ADC_NONE;
+                switch (run.key) {
+                    case keys::kcRight:  level = ADC_RIGHT; break;
+                    case keys::kcUp:     level = ADC_UP; break;
+                    case keys::kcDown:   level = ADC_DOWN; break;
+                    case keys::kcLeft:   level = ADC_LEFT; break;
+                    default:             level = ADC_SELECT; break;
+                }
+                // far apart enough for no double clicks
+                run.press_ms = hal::now_us() / 1000 + 400 + rng() % 7;
+                run.release_ms = run.press_ms + 150;
+                for (uint8_t b = 0; b < INPUTS[in].bounce_ms; b++) {
+                    hal::adc_push(keys::P_KEYBOARD, run.press_ms + b, b % 2 ? ADC_NONE : level);
+                    hal::adc_push(keys::P_KEYBOARD, run.release_ms + b, b % 2 ? level : ADC_NONE);
+                }
+                hal::adc_push(keys::P_KEYBOARD, run.press_ms + INPUTS[in].bounce_ms, level);
+                hal::adc_push(keys::P_KEYBOARD, run.release_ms + INPUTS[in].bounce_ms, ADC_NONE);
+                hal::set_us((run.release_ms + 100) * 1000);
+
+                keys::KeyEvent ev;
+                while (kbd.get_event(ev))
+                    run.events.push_back(ev);
+                account(now_l, run);
+                run.events.swap(legacy);
+                account(old_l, run);
+                legacy.clear();
+            }
+            hal::detach_isr(legacy_isr);
+            kbd.end_sampling();
+
+            print_latency(INPUTS[in].name, "20 ms", old_l);
+            print_latency("", "integr.", now_l);
+            ok = ok && now_l.missed == 0;
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Keypad: the shield's ladder, a 4x4 matrix and two buttons pressed at once,
+    // the merged events split by source
+
+    const uint8_t
+        KP_ROWS[keys::MATRIX_MAX] = {2, 3, 11, 12},
+        KP_COLS[keys::MATRIX_MAX] = {15, 16, 17, 18},
+        KP_BUTTONS[2] = {4, 5};
+
+    enum { srcLadder, srcMatrix, srcButtons, srcCount };
+
+    struct KeypadPress {
+        uint8_t src;
+        keys::KeyCode key;
+        uint16_t level;     // ADC level of a ladder key
+        uint64_t at_ms;
+        uint64_t hold_ms;
+    };
+
+    void press_switch(const KeypadPress &p, bool closed)
+    {
+        if (p.src == srcButtons) {
+            hal::switch_set(KP_BUTTONS[p.key - keys::kcButton], hal::GND, closed);
+            return;
+        }
+
+        uint8_t k = p.key - keys::kcMatrix;
+        hal::switch_set(KP_ROWS[k / keys::MATRIX_MAX], KP_COLS[k % keys::MATRIX_MAX], closed);
+    }
+
+    int cmd_keypad(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 200;
+        const uint16_t LEVELS[keys::LADDER_KEYS] = {ADC_RIGHT, ADC_UP, ADC_DOWN, ADC_LEFT, ADC_SELECT};
+        const char *NAMES[srcCount] = {"ladder", "matrix", "buttons"};
+
+        hal::reset();
+        hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+        keys::Keyboard kbd(keys::P_KEYBOARD);
+        keys::Matrix matrix(KP_ROWS, keys::MATRIX_MAX, KP_COLS, keys::MATRIX_MAX);
+        keys::Buttons buttons(KP_BUTTONS, 2, true);
+        kbd.add(matrix);
+        kbd.add(buttons);
+        kbd.begin_sampling();
+
+        // every round two sources are pressed at once, some of them long
+        std::mt19937 rng(opt.seed);
+        std::vector<KeypadPress> presses;
+        uint64_t t = 100;
+        for (int i = 0; i < n; i++) {
+            uint8_t first = rng() % srcCount,
+                    second = (first + 1 + rng() % (srcCount - 1)) % srcCount;
+            for (uint8_t s = 0; s < 2; s++) {
+                KeypadPress p;
+                uint8_t k = rng() % 16;
+                p.src = s == 0 ? first : second;
+                p.key = p.src == srcLadder ? LADDER[k % keys::LADDER_KEYS] :
+                        p.src == srcMatrix ? keys::KeyCode(keys::kcMatrix + k) :
+                                             keys::KeyCode(keys::kcButton + k % 2);
+                p.level = LEVELS[k % keys::LADDER_KEYS];
+                p.at_ms = t + rng() % 300;
+                p.hold_ms = 60 + rng() % 900;
+                presses.push_back(p);
+            }
+            t += 1700;
+        }
+
+        std::vector<keys::KeyEvent> events;
+        for (uint64_t ms = 0; ms < t; ms++) {
+            for (size_t i = 0; i < presses.size(); i++) {
+                const KeypadPress &p = presses[i];
+                if (p.at_ms != ms && p.at_ms + p.hold_ms != ms)
+                    continue;
+                bool down = p.at_ms == ms;
+                if (p.src == srcLadder)
+                    hal::adc_set(keys::P_KEYBOARD, down ? p.level : ADC_NONE);
+                else
+                    press_switch(p, down);
+            }
+            hal::set_us((ms + 1) * 1000);
+
+            keys::KeyEvent ev;
+            while (kbd.get_event(ev))
+                events.push_back(ev);
+        }
+        kbd.end_sampling();
+
+        // a release is kcNone whatever the source, so the presses are told
+        // apart by their codes: the first event of the key is its press, and
+        // it turns kmLong if held past the timeout
+        struct {
+            uint32_t presses, missed, longs, wrong;
+            uint64_t lat_sum, lat_max;
+        } st[srcCount] = {};
+        for (size_t i = 0; i < presses.size(); i++) {
+            const KeypadPress &p = presses[i];
+            bool seen = false,
+                 is_long = false;
+            for (size_t e = 0; e < events.size(); e++) {
+                const keys::KeyEvent &ev = events[e];
+                if (ev.key.code != p.key || ev.time < p.at_ms || ev.time > p.at_ms + p.hold_ms + 20)
+                    continue;
+                if (!seen) {
+                    seen = true;
+                    uint64_t lat = ev.time - p.at_ms;
+                    st[p.src].lat_sum += lat;
+                    if (lat > st[p.src].lat_max)
+                        st[p.src].lat_max = lat;
+                }
+                if (ev.key.mode == keys::kmLong)
+                    is_long = true;
+            }
+            st[p.src].presses++;
+            if (!seen)
+                st[p.src].missed++;
+            if (is_long)
+                st[p.src].longs++;
+            // the debounce and a matrix scan are left some slack around the timeout
+            if ((is_long && p.hold_ms < keys::LONG_PRESS_TOUT) ||
+                (!is_long && p.hold_ms > keys::LONG_PRESS_TOUT + 30))
+                st[p.src].wrong++;
+        }
+
+        printf("%d rounds of two sources pressed at once, %u events, %u lost\n",
+               n, unsigned(events.size()), unsigned(kbd.get_lost_events()));
+        printf("source   presses  long  latency ms   missed  wrong\n");
+        printf("                        mean  max\n");
+        bool ok = kbd.get_lost_events() == 0;
+        for (uint8_t s = 0; s < srcCount; s++) {
+            printf("%-8s %7u %5u  %5.1f %4llu   %6u %6u\n", NAMES[s], st[s].presses, st[s].longs,
+                   st[s].presses > st[s].missed ?
+                       double(st[s].lat_sum) / (st[s].presses - st[s].missed) : 0.0,
+                   (unsigned long long)st[s].lat_max, st[s].missed, st[s].wrong);
+            ok = ok && st[s].missed == 0 && st[s].wrong == 0;
+        }
+
+        return ok ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Random intervals: the cost of a draw, the chi-square test of every
+    // distribution against its law and the seeds of noisy power-ons
+
+    const uint16_t RAND_LO = rtimer::TIMER_MIN_DEFAULT,
+                   RAND_HI = rtimer::TIMER_MAX_DEFAULT;
+
+    // CDF of the sum of 12 uniform numbers (Irwin-Hall)
+    double irwin_hall12(double x)
+    {
+        if (x <= 0)
+            return 0;
+        if (x >= 12)
+            return 1;
+
+        double sum = 0,
+               binom = 1;
+        for (int k = 0; k <= int(x); k++) {
+            sum += (k % 2 ? -binom : binom) * pow(x - k, 12);
+            binom = binom * (12 - k) / (k + 1);
+        }
+
+        return sum / 479001600.0;
+    }
+
+    // Probability of the value lo + j of [lo, hi] drawn from the distribution
+    double expected(rtimer::Random::Distribution d, uint32_t j, uint32_t range)
+    {
+        double a = double(j) / range,
+               b = double(j + 1) / range;
+        switch (d) {
+            case rtimer::Random::dNormal:
+                return (irwin_hall12(2 + 8 * b) - irwin_hall12(2 + 8 * a)) /
+                       (irwin_hall12(10) - irwin_hall12(2));
+            case rtimer::Random::dExponential:
+                return (exp(-4 * a) - exp(-4 * b)) / (1 - exp(-4));
+            default:
+                return 1.0 / range;
+        }
+    }
+
+    // Upper tail of the chi-square distribution, Wilson-Hilferty approximation
+    double chi2_p(double chi2, uint32_t df)
+    {
+        double v = 2.0 / (9.0 * df),
+               z = (pow(chi2 / df, 1.0 / 3) - (1 - v)) / sqrt(v);
+
+        return 0.5 * erfc(z / sqrt(2.0));
+    }
+
+    int cmd_rand(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 1000000;
+        const uint32_t range = RAND_HI - RAND_LO + 1;
+        const char *NAMES[] = {"uniform", "normal", "exp"};
+        rtimer::Random rnd(opt.seed);
+        volatile uint32_t sink = 0;
+
+        // the board's random() against the generator, on the same interval
+        const uint32_t draws = 10000000;
+        randomSeed(opt.seed);
+        HostClock::time_point t0 = HostClock::now();
+        for (uint32_t i = 0; i < draws; i++)
+            sink = sink + random(RAND_LO, RAND_HI + 1);
+        double libc_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        t0 = HostClock::now();
+        for (uint32_t i = 0; i < draws; i++)
+            sink = sink + rnd.next();
+        double next_s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        printf("%u draws in [%u, %u]: random() %.2f ns, next() %.2f ns",
+               draws, RAND_LO, RAND_HI, libc_s * 1e9 / draws, next_s * 1e9 / draws);
+        for (int d = 0; d < 3; d++) {
+            t0 = HostClock::now();
+            for (uint32_t i = 0; i < draws; i++)
+                sink = sink + rnd.draw(rtimer::Random::Distribution(d), RAND_LO, RAND_HI);
+            double s = std::chrono::duration<double>(HostClock::now() - t0).count();
+            printf(", %s %.2f ns", NAMES[d], s * 1e9 / draws);
+        }
+        printf("\n");
+
+        // every value of the interval is a bin
+        printf("chi-square of %d draws, %u bins\n", n, range);
+        printf("distribution  mean    chi2     p\n");
+        bool ok = true;
+        for (int d = 0; d < 3; d++) {
+            rtimer::Random::Distribution dist = rtimer::Random::Distribution(d);
+            std::vector<uint32_t> bins(range);
+            double sum = 0;
+            rnd.seed(opt.seed);
+            for (int i = 0; i < n; i++) {
+                uint16_t v = rnd.draw(dist, RAND_LO, RAND_HI);
+                if (v < RAND_LO || v > RAND_HI) {
+                    printf("%s: %u is out of the interval\n", NAMES[d], v);
+                    return 1;
+                }
+                bins[v - RAND_LO]++;
+                sum += v;
+            }
+            double chi2 = 0;
+            for (uint32_t j = 0; j < range; j++) {
+                double e = n * expected(dist, j, range);
+                chi2 += (bins[j] - e) * (bins[j] - e) / e;
+            }
+            double p = chi2_p(chi2, range - 1);
+            printf("%-12s %6.2f %8.1f  %6.4f\n", NAMES[d], sum / n, chi2, p);
+            ok = ok && p > 0.001;
+        }
+
+        // the seeds of power-ons with a little noise on the open pin, and
+        // what the keyboard pin gave before
+        const int boots = 1000;
+        std::vector<uint32_t> seeds, old_seeds;
+        for (int i = 0; i < boots; i++) {
+            hal::reset();
+            hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+            hal::adc_set(rtimer::P_NOISE, 512);
+            hal::adc_noise(rtimer::P_NOISE, 1.0, 0, opt.seed + i);
+            seeds.push_back(rtimer::Random::entropy(rtimer::P_NOISE));
+            old_seeds.push_back(analogRead(keys::P_KEYBOARD));
+        }
+        std::sort(seeds.begin(), seeds.end());
+        size_t distinct = std::unique(seeds.begin(), seeds.end()) - seeds.begin();
+        std::sort(old_seeds.begin(), old_seeds.end());
+        size_t old_distinct = std::unique(old_seeds.begin(), old_seeds.end()) - old_seeds.begin();
+        printf("%d power-ons: %u distinct seeds from the open pin, %u from the keyboard pin\n",
+               boots, unsigned(distinct), unsigned(old_distinct));
+        ok = ok && distinct > boots * 99 / 100;
+        (void)sink;
+
+        return ok ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Session plans: the played phases against the plan dumped over the serial
+    // port, and the same session again from the same seed
+
+    // The voice's pitch of a note, as the beeper plays it
+    unsigned int voiced(unsigned int freq, uint8_t voice)
+    {
+        const uint16_t PITCH[] = {256, 299, 341};
+
+        return uint32_t(freq) * PITCH[voice] >> 8;
+    }
+
+    // Times of the beeps of the frequency. The repeats of a phase beep are one beep
+    std::vector<uint64_t> beeps_of(unsigned int freq)
+    {
+        std::vector<uint64_t> at;
+        for (size_t t = 0; t < hal::tones().size(); t++)
+            if (hal::tones()[t].freq == freq &&
+                (at.empty() || hal::tones()[t].at_ms - at.back() > 1000))
+                at.push_back(hal::tones()[t].at_ms);
+
+        return at;
+    }
+
+    // Phases of a dumped plan: index, kind, length lines after the header.
+    // The dump starts at the first phase still in the buffer, its index from
+    // 0 goes to first
+    std::vector<rtimer::Plan::Phase> parse_plan(const std::string &dump, size_t &first)
+    {
+        std::vector<rtimer::Plan::Phase> phases;
+        size_t pos = dump.find('\n');
+        first = 0;
+        while (pos != std::string::npos && pos + 1 < dump.size()) {
+            unsigned i, k, secs;
+            if (sscanf(dump.c_str() + pos + 1, "%u,%u,%u", &i, &k, &secs) == 3) {
+                rtimer::Plan::Phase ph = {uint8_t(k), uint16_t(secs)};
+                if (phases.empty())
+                    first = i - 1;
+                phases.push_back(ph);
+            }
+            pos = dump.find('\n', pos + 1);
+        }
+
+        return phases;
+    }
+
+    // Every phase of the plan starts with the beep of its kind (btStart of
+    // the work-like ones, btDelay of the others) in the voice and lasts its
+    // seconds, give or take slack_ms, up to the next phase beep or the end
+    // beep. The plan starts at the phase of index first, the beeps of the
+    // ones before it are skipped. Counts the phases checked
+    bool follows(const std::vector<rtimer::Plan::Phase> &plan, size_t first, uint8_t voice,
+                 int64_t slack_ms, uint32_t &phases)
+    {
+        const unsigned int FREQ_WORK = 1500,
+                           FREQ_REST = 1000,
+                           FREQ_END = 100;
+
+        std::vector<std::pair<uint64_t, int> > beeps;
+        const unsigned int freqs[3] = {FREQ_WORK, FREQ_REST, FREQ_END};
+        for (int f = 0; f < 3; f++) {
+            std::vector<uint64_t> at = beeps_of(voiced(freqs[f], voice));
+            for (size_t b = 0; b < at.size(); b++)
+                beeps.push_back(std::make_pair(at[b], f));
+        }
+        std::sort(beeps.begin(), beeps.end());
+
+        if (beeps.size() != first + plan.size() + 1 || beeps.back().second != 2)
+            return false;
+        for (size_t p = 0; p < plan.size(); p++) {
+            size_t b = first + p;
+            int64_t ms = int64_t(beeps[b + 1].first - beeps[b].first);
+            if (beeps[b].second != (rtimer::Program::is_work(plan[p].kind) ? 0 : 1) ||
+                llabs(ms - int64_t(plan[p].secs) * 1000) > slack_ms)
+                return false;
+            phases++;
+        }
+
+        return true;
+    }
+
+    int cmd_plan(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 20;
+        Options o = opt;
+        if (o.rounds <= 0)
+            o.rounds = 10;
+        Board board;
+        int bad = 0;
+        uint32_t phases = 0;
+
+        for (int i = 0; i < n; i++) {
+            SessionResult r = play_session(board, o, opt.seed + i);
+            const rtimer::Plan &plan = board.get().get_plan();
+            hal::clear_serial();
+            board.get().dump_plan(Serial);
+            std::string dump = hal::serial_output();
+
+            // the stopped timer page previews the first phase still in the
+            // buffer, the rounds are a work and a delay but the last one
+            rtimer::Plan::Phase ph;
+            char first[32] = "";
+            if (plan.peek(plan.get_first(), ph))
+                snprintf(first, sizeof(first), "P%u %c:%u", plan.get_first() + 1,
+                         "WDUBC"[ph.kind], ph.secs);
+            bool ok = r.finished && plan.get_drawn() == unsigned(2 * o.rounds - 1) &&
+                      first[0] != 0 && hal::lcd_line(1).find(first) == 0;
+
+            // the phase beeps are the planned seconds apart, to the sound
+            size_t from;
+            std::vector<rtimer::Plan::Phase> phs = parse_plan(dump, from);
+            ok = ok && from == plan.get_first() && follows(phs, from, 0, 499, phases);
+
+            // the seed of the dump plays the same session again
+            play_session(board, o, opt.seed + i);
+            hal::clear_serial();
+            board.get().dump_plan(Serial);
+            ok = ok && hal::serial_output() == dump;
+
+            if (i == 0)
+                printf("%s", dump.c_str());
+            if (!ok) {
+                printf("session %d (seed %lu) doesn't follow its plan\n", i, opt.seed + i);
+                bad++;
+            }
+        }
+
+        printf("%d sessions of %d rounds, %u phases checked, %d off the plan\n",
+               n, o.rounds, phases, bad);
+
+        // an endless session of fixed phases past the 16-bit phase index:
+        // the plan keeps drawing and peeking around the wrap
+        rtimer::Program fixed;
+        fixed.add_repeat(0);
+        fixed.add_phase(rtimer::Program::pkWork, rtimer::Program::pmFixed, 30, 30);
+        fixed.add_phase(rtimer::Program::pkRest, rtimer::Program::pmFixed, 10, 10);
+        fixed.add_next();
+        fixed.add_end();
+        rtimer::Plan endless;
+        endless.start(opt.seed, fixed);
+        uint32_t taken = 0;
+        bool wraps = true;
+        for (; wraps && taken < 70000; taken++) {
+            rtimer::Plan::Phase ph, first, drawn;
+            endless.fill();
+            wraps = endless.next(ph) && ph.kind == taken % 2 && ph.secs == (taken % 2 ? 10 : 30) &&
+                    endless.peek(endless.get_first(), first) &&
+                    endless.peek(uint16_t(endless.get_drawn() - 1), drawn) &&
+                    !endless.peek(endless.get_drawn(), drawn);
+        }
+        printf("endless fixed session: %u phases, %s the index wrap\n", taken,
+               wraps ? "past" : "NOT past");
+        if (!wraps)
+            bad++;
+
+        return bad == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Concurrent timers: the cost of the wheel and the sessions of all the
+    // timers at once, told apart by the voices of their beeps
+
+    // The timers share the beeper, so a beep waits for the patterns of the
+    // others queued before it: a phase is the planned seconds give or take
+    // the longest pattern
+    const int64_t SLACK_MS = 1500;
+
+    // Passes of the wheel: every entry is due once a second and is set again
+    // a second later, as a timer's ticks are. Returns ns per 1 ms pass
+    double wheel_pass_ns(uint8_t entries, bool scan, uint32_t seconds)
+    {
+        rtimer::TimerWheel wheel;
+        unsigned long at[rtimer::TimerWheel::MAX_ENTRIES];
+        std::mt19937 rng(entries);
+        for (uint8_t i = 0; i < entries; i++) {
+            at[i] = 1 + rng() % 1000;
+            wheel.set(i, at[i]);
+        }
+
+        volatile uint32_t sink = 0;
+        HostClock::time_point t0 = HostClock::now();
+        for (unsigned long now = 1; now <= seconds * 1000; now++) {
+            if (scan) {
+                for (uint8_t i = 0; i < entries; i++)
+                    if (long(at[i] - now) <= 0) {
+                        at[i] += 1000;
+                        sink = sink + i;
+                    }
+                continue;
+            }
+            uint8_t id;
+            while ((id = wheel.expired(now)) != rtimer::TimerWheel::NONE) {
+                wheel.set(id, now + 1000);
+                sink = sink + id;
+            }
+        }
+        double s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        (void)sink;
+
+        return s * 1e9 / (seconds * 1000.0);
+    }
+
+    // The wheel across the millis() rollover: the board's 32-bit ms start
+    // seconds before 0xFFFFFFFF and every entry, due once a second, has to
+    // be the next deadline and expire at its ms. Returns the entries which
+    // weren't, or didn't keep going
+    uint32_t wheel_rollover(uint32_t seconds)
+    {
+        const uint32_t START = 0xFFFFFFFFUL - 5000;
+        rtimer::TimerWheel wheel;
+        uint32_t at[rtimer::TimerWheel::MAX_ENTRIES];
+        for (uint8_t i = 0; i < rtimer::TimerWheel::MAX_ENTRIES; i++) {
+            at[i] = START + 1 + 250 * i;
+            wheel.set(i, at[i]);
+        }
+
+        uint32_t bad = 0,
+                 now = START;
+        for (uint32_t ms = 1; ms <= seconds * 1000; ms++) {
+            now = START + ms;
+            uint32_t first = at[0];
+            for (uint8_t i = 1; i < rtimer::TimerWheel::MAX_ENTRIES; i++)
+                if (int32_t(at[i] - first) < 0)
+                    first = at[i];
+            if (uint32_t(wheel.next_deadline()) != first)
+                bad++;
+
+            uint8_t id;
+            while ((id = wheel.expired(now)) != rtimer::TimerWheel::NONE) {
+                if (at[id] != now)
+                    bad++;
+                at[id] = now + 1000;
+                wheel.set(id, at[id]);
+            }
+        }
+        for (uint8_t i = 0; i < rtimer::TimerWheel::MAX_ENTRIES; i++)
+            if (at[i] - now > 1000)
+                bad++;
+
+        return bad;
+    }
+
+    int cmd_timers(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 5;
+        int rounds = opt.rounds > 0 ? opt.rounds : 5;
+
+        printf("entries  wheel ns/pass  scan ns/pass\n");
+        for (uint8_t e = 1; e <= rtimer::TimerWheel::MAX_ENTRIES; e *= 2)
+            printf("%7u %14.2f %13.2f\n", e, wheel_pass_ns(e, false, 20000),
+                   wheel_pass_ns(e, true, 20000));
+
+        Board board;
+        int bad = 0;
+        uint32_t phases = 0,
+                 lost = 0;
+        for (int i = 0; i < n; i++) {
+            board.power_off();
+            hal::reset();
+            hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+            // the timers differ in their distributions and in their rounds
+            preset_rounds(uint8_t(rounds));
+            for (uint8_t k = 1; k < rtimer::TIMERS; k++) {
+                uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE];
+                make_settings(cfg, uint8_t(rounds + k));
+                cfg[0] = cfg[3] = 1 + k;
+                rtimer::ConfigStore st(rtimer::TIMER_RECORD + k - 1,
+                                       rtimer::TIMER_FIRST + (k - 1) * rtimer::TIMER_SLOTS,
+                                       rtimer::TIMER_SLOTS);
+                st.save(cfg);
+            }
+            rtimer::RTimer &rtm = board.power_on();
+            rtm.seed_random(opt.seed + i);
+
+            // the timer page, then SELECT starts a timer and UP goes to the next one
+            uint64_t t = hal::now_us() / 1000 + 100;
+            press(t, ADC_SELECT, 100);
+            for (uint8_t k = 0; k < rtimer::TIMERS; k++) {
+                press(t += 3000, ADC_SELECT, 100);
+                press(t += 500, ADC_UP, 100);
+            }
+
+            int ends = 0;
+            while (hal::now_us() / 1000 < SESSION_LIMIT_MS && ends < rtimer::TIMERS) {
+                rtm.run();
+                step(rtm, opt);
+                ends = 0;
+                for (uint8_t k = 0; k < rtimer::TIMERS; k++)
+                    ends += !beeps_of(voiced(100, k)).empty();
+            }
+            lost += rtm.get_stats().beeps_lost;
+
+            // every timer's plan, from the page of each of them
+            std::string dumps[rtimer::TIMERS];
+            for (uint8_t k = 0; k < rtimer::TIMERS; k++) {
+                hal::clear_serial();
+                rtm.dump_plan(Serial);
+                dumps[rtm.get_selected()] = hal::serial_output();
+                uint64_t now = hal::now_us() / 1000;
+                press(now + 10, ADC_UP, 100);
+                while (hal::now_us() / 1000 < now + 300) {
+                    rtm.run();
+                    step(rtm, opt);
+                }
+            }
+
+            bool ok = ends == rtimer::TIMERS;
+            for (uint8_t k = 0; ok && k < rtimer::TIMERS; k++) {
+                size_t from;
+                std::vector<rtimer::Plan::Phase> plan = parse_plan(dumps[k], from);
+                ok = from + plan.size() == size_t(2 * (rounds + k) - 1) &&
+                     follows(plan, from, k, SLACK_MS, phases);
+            }
+            if (!ok) {
+                printf("run %d (seed %lu): the timers don't follow their plans\n", i, opt.seed + i);
+                bad++;
+            }
+        }
+
+        printf("%d runs of %u timers, %u phases checked, %u beeps dropped, %d off the plan\n",
+               n, rtimer::TIMERS, phases, lost, bad);
+
+        uint32_t rolled = wheel_rollover(20);
+        printf("wheel across the millis() rollover: %u deadlines off\n", rolled);
+        if (rolled > 0)
+            bad++;
+
+        return bad == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Interval programs: the cost of the interpreter and the bytes of a program
+    // per phase, with every program of the flash and the one of the default
+    // rounds played against its plan
+
+    // ns per phase of running the program to its end over and over
+    double step_ns(const rtimer::Program &prog, uint32_t &count)
+    {
+        rtimer::Program::Phase ph;
+        volatile uint32_t sink = 0;
+        const uint32_t TARGET = 1000000;
+        uint32_t n = 0;
+
+        HostClock::time_point t0 = HostClock::now();
+        while (n < TARGET) {
+            rtimer::Program::Cursor c = rtimer::Program::Cursor();
+            count = 0;
+            while (prog.step(c, ph)) {
+                sink = sink + ph.lo;
+                count++;
+            }
+            n += count + 1;
+        }
+        double s = std::chrono::duration<double>(HostClock::now() - t0).count();
+        (void)sink;
+
+        return s * 1e9 / n;
+    }
+
+    int cmd_prog(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 3;
+        Options o = opt;
+        if (o.rounds <= 0)
+            o.rounds = 10;
+        Board board;
+        int bad = 0;
+        uint32_t phases = 0,
+                 longs = 0;
+
+        // a phase over 255 s goes in minutes, one which doesn't fit is refused
+        rtimer::Program lp;
+        rtimer::Program::Cursor lc = rtimer::Program::Cursor();
+        rtimer::Program::Phase lph;
+        bool encoded = lp.add_phase(rtimer::Program::pkBreak, rtimer::Program::pmUniform, 240, 600) &&
+                       !lp.add_phase(rtimer::Program::pkBreak, rtimer::Program::pmFixed, 301, 0) &&
+                       !lp.add_phase(rtimer::Program::pkBreak, rtimer::Program::pmFixed,
+                                     rtimer::Program::MAX_SECS + 60, 0) &&
+                       lp.add_end() && lp.size() == 4 && lp.step(lc, lph) && lph.minutes &&
+                       lph.lo == 4 && lph.hi == 10;
+        if (!encoded) {
+            printf("a long phase is encoded wrong\n");
+            bad++;
+        }
+
+        // a full program keeps its last byte for the END, and one without
+        // an END isn't loaded
+        rtimer::Program full;
+        bool fits = full.add_repeat(2);
+        for (uint8_t p = 0; p < 9; p++)
+            fits = fits && full.add_phase(rtimer::Program::pkWork, rtimer::Program::pmUniform, 30, 60);
+        fits = fits && full.add_next() &&
+               !full.add_phase(rtimer::Program::pkRest, rtimer::Program::pmFixed, 10, 10) &&
+               full.add_end() && full.size() == rtimer::Program::MAX_BYTES - 1 && full.check();
+        rtimer::Program::Cursor fc = rtimer::Program::Cursor();
+        uint8_t steps = 0;
+        while (fits && full.step(fc, lph))
+            steps++;
+        uint8_t endless[rtimer::Program::MAX_BYTES];
+        for (uint8_t b = 0; b < sizeof(endless); b += 2) {
+            endless[b] = rtimer::Program::opPhase << 6 | rtimer::Program::pkWork << 2;
+            endless[b + 1] = 30;
+        }
+        if (!fits || steps != 18 || full.load_P(endless, sizeof(endless)) || full.size() != 0) {
+            printf("a full program isn't terminated\n");
+            bad++;
+        }
+
+        printf("program  bytes  phases  bytes/phase  ns/phase\n");
+        for (int i = 0; i < n; i++)
+            for (uint8_t k = 0; k <= rtimer::PROGRAMS; k++) {
+                // 0 is the program compiled from the rounds of the settings,
+                // then the programs of the flash by their numbers (trmProgram, 3)
+                uint8_t cfg[rtimer::ConfigStore::PAYLOAD_SIZE];
+                make_settings(cfg, k == 0 ? uint8_t(o.rounds) : k);
+                if (k > 0)
+                    cfg[6] = 3;
+                SessionResult r = play_session(board, o, opt.seed + i, cfg);
+                hal::clear_serial();
+                board.get().dump_plan(Serial);
+                size_t from;
+                std::vector<rtimer::Plan::Phase> plan = parse_plan(hal::serial_output(), from);
+
+                const rtimer::Program &prog = *board.get().get_plan().get_program();
+                uint32_t count = 0;
+                double ns = i == 0 ? step_ns(prog, count) : 0;
+                if (i == 0) {
+                    char name[8] = "rounds";
+                    if (k > 0)
+                        snprintf(name, sizeof(name), "%u", k);
+                    printf("%7s %6u %7u %12.2f %9.2f\n", name, prog.size(), count,
+                           double(prog.size()) / count, ns);
+                }
+
+                // the drawn long breaks are whole minutes of their range
+                bool minutes = true;
+                for (size_t p = 0; p < plan.size(); p++)
+                    if (plan[p].secs > rtimer::Program::MAX_SHORT) {
+                        longs++;
+                        minutes = minutes && plan[p].secs % 60 == 0 && plan[p].secs <= 600;
+                    }
+
+                if (!r.finished || !prog.check() || !minutes || !follows(plan, from, 0, 499, phases)) {
+                    printf("program %u (seed %lu) doesn't follow its plan\n", k, opt.seed + i);
+                    bad++;
+                }
+            }
+
+        printf("%d sessions of %u programs, %u phases checked, %u of them in minutes, "
+               "%d off the plan\n", n, rtimer::PROGRAMS + 1, phases, longs, bad);
+
+        return bad == 0 ? 0 : 1;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // Event log: the cost of logging an event, then sessions with a pause
+    // whose log is checked against the beeps and the plan, saved at the end
+    // of the session and read back after a power cycle
+
+    unsigned long log_clock_ms = 0;
+
+    unsigned long log_clock()
+    {
+        return log_clock_ms += 1000;
+    }
+
+    std::vector<rtimer::EventLog::Event> parse_log(const std::string &dump)
+    {
+        std::vector<rtimer::EventLog::Event> events;
+        std::vector<uint8_t> data;
+        unsigned long base = 0;
+        size_t pos = 0;
+        while (pos < dump.size()) {
+            size_t end = dump.find('\n', pos);
+            std::string line = dump.substr(pos, end == std::string::npos ? end : end - pos);
+            while (!line.empty() && (line.back() == '\r' || line.back() == '\n'))
+                line.pop_back();
+            if (sscanf(line.c_str(), "log,%lu", &base) != 1)
+                for (size_t i = 0; i + 1 < line.size(); i += 2)
+                    data.push_back(uint8_t(strtoul(line.substr(i, 2).c_str(), NULL, 16)));
+            pos = end == std::string::npos ? dump.size() : end + 1;
+        }
+
+        rtimer::EventLog::Event e;
+        e.at = uint32_t(base);
+        uint16_t at = 0;
+        while (rtimer::EventLog::decode(data.data(), uint16_t(data.size()), at, e))
+            events.push_back(e);
+
+        return events;
+    }
+
+    bool same(const rtimer::EventLog::Event &a, const rtimer::EventLog::Event &b)
+    {
+        return a.at == b.at && a.type == b.type && a.arg == b.arg && a.value == b.value;
+    }
+
+    int cmd_log(const Options &opt)
+    {
+        int n = opt.n > 0 ? opt.n : 10;
+        int rounds = opt.rounds > 0 ? opt.rounds : 3;
+        const uint8_t BTEND = 4;    // Beeper::btEnd
+
+        // host cost of an event, a beep and a phase a second apart
+        const uint32_t EVENTS = 1000000;
+        rtimer::EventLog bench(log_clock, rtimer::LOG_RECORD, rtimer::LOG_FIRST,
+                               rtimer::LOG_SLOTS);
+        HostClock::time_point t0 = HostClock::now();
+        for (uint32_t i = 0; i < EVENTS; i += 2) {
+            bench.beep(i & 3, 0);
+            bench.phase(0, 0, uint8_t(i));
+        }
+        double ns = std::chrono::duration<double>(HostClock::now() - t0).count() * 1e9 / EVENTS;
+        printf("%.1f ns per logged event, %u bytes for %u events in the ring\n",
+               ns, bench.size(), unsigned(bench.get_events() - bench.get_dropped()));
+
+        Board board;
+        int bad = 0;
+        uint32_t logged = 0,
+                 bytes = 0,
+                 saved = 0;
+        for (int i = 0; i < n; i++) {
+            board.power_off();
+            hal::reset();
+            hal::adc_set(keys::P_KEYBOARD, ADC_NONE);
+            preset_rounds(uint8_t(rounds));
+            rtimer::RTimer &rtm = board.power_on();
+            rtm.seed_random(opt.seed + i);
+            rtm.set_log_autosave(true);
+
+            // a pause in the first work, then the session to its end and
+            // the flush of the log after it
+            uint64_t start = hal::now_us() / 1000;
+            press(start + 100, ADC_SELECT, 100);
+            press(start + 600, ADC_SELECT, 100);
+            press(start + 15000, ADC_RIGHT, 100);
+            press(start + 18000, ADC_RIGHT, 100);
+            size_t seen = 0;
+            uint64_t end_ms = 0;
+            bool finished = false;
+            while (hal::now_us() / 1000 - start < SESSION_LIMIT_MS &&
+                   (!finished || hal::now_us() / 1000 < end_ms + 1000)) {
+                rtm.run();
+                finished = finished || ended(seen, end_ms);
+                step(rtm, opt);
+            }
+
+            hal::clear_serial();
+            rtm.dump_log(Serial);
+            std::string dump = hal::serial_output();
+            std::vector<rtimer::EventLog::Event> ram = parse_log(dump);
+            const rtimer::Plan &plan = rtm.get_plan();
+
+            // the newest events are the stop and the end beep at the end tone
+            const rtimer::EventLog &log = rtm.get_log();
+            bool ok = finished && ram.size() >= 2 &&
+                      ram.size() == log.get_events() - log.get_dropped();
+            size_t last = ram.size() - 1;
+            ok = ok && ram[last - 1].type == rtimer::EventLog::evState && ram[last - 1].arg == 0 &&
+                 ram[last].type == rtimer::EventLog::evBeep && ram[last].arg == BTEND &&
+                 llabs(int64_t(ram[last].at) - int64_t(end_ms)) <= 2;
+
+            // the phases still in the ring are the last ones of the plan
+            std::vector<rtimer::Plan::Phase> phases;
+            for (size_t k = 0; k < ram.size(); k++)
+                if (ram[k].type == rtimer::EventLog::evPhase) {
+                    rtimer::Plan::Phase ph = {uint8_t(ram[k].arg & 7), ram[k].value};
+                    phases.push_back(ph);
+                }
+            for (size_t k = 0; ok && k < phases.size(); k++) {
+                rtimer::Plan::Phase ph;
+                ok = plan.peek(plan.get_taken() - phases.size() + k, ph) &&
+                     ph.kind == phases[k].kind && ph.secs == phases[k].secs;
+            }
+            ok = ok && !phases.empty();
+
+            // the pause is logged while it's in the ring
+            bool paused = false;
+            for (size_t k = 0; k < ram.size(); k++)
+                paused = paused || (ram[k].type == rtimer::EventLog::evState &&
+                                    (ram[k].arg == 4 || ram[k].arg == 5));
+            ok = ok && (paused || log.get_dropped() > 0);
+            logged += ram.size();
+            bytes += log.size();
+
+            // the EEPROM has the newest events over a power cycle
+            board.power_off();
+            rtimer::RTimer &again = board.power_on();
+            hal::clear_serial();
+            again.dump_saved_log(Serial);
+            std::string saved_dump = hal::serial_output();
+            std::vector<rtimer::EventLog::Event> kept = parse_log(saved_dump);
+            size_t events = 0;
+            for (size_t k = 0; k < kept.size(); k++)
+                if (kept[k].type != rtimer::EventLog::evMark)
+                    events++;
+            ok = ok && events > 0 && events <= ram.size() &&
+                 kept.back().type != rtimer::EventLog::evMark;
+            for (size_t k = 0; ok && k < events; k++)
+                ok = same(kept[kept.size() - 1 - k], ram[ram.size() - 1 - k]);
+
+            saved += events;
+            if (i == 0)
+                printf("%s%s", dump.c_str(), saved_dump.c_str());
+            if (!ok) {
+                printf("session %d (seed %lu): the log doesn't match the session\n", i,
+                       opt.seed + i);
+                bad++;
+            }
+        }
+
+        printf("%d sessions of %d rounds, %u events in the ring, %.2f bytes per event, "
+               "%u events saved, %d off the session\n",
+               n, rounds, logged, logged ? double(bytes) / logged : 0.0, saved, bad);
+
+        return bad == 0 ? 0 : 1;
+    }
+
+    int usage()
+    {
+        fprintf(stderr, "usage: rtsim session [-n N] [-seed S] [-rounds R] [-pause AT:LEN]\n"
+                        "                     [-realtime [-loop US] | -tickless]\n"
+                        "       rtsim bench [-n N]\n"
+                        "       rtsim edit [-n N] [-idle MS] [-hold MS]\n"
+                        "       rtsim wear [-n N]\n"
+                        "       rtsim keys [-n N] [-seed S]\n"
+                        "       rtsim debounce [-n N] [-seed S]\n"
+                        "       rtsim keypad [-n N] [-seed S]\n"
+                        "       rtsim rand [-n N] [-seed S]\n"
+                        "       rtsim plan [-n N] [-seed S] [-rounds R]\n"
+                        "       rtsim timers [-n N] [-seed S] [-rounds R]\n"
+                        "       rtsim prog [-n N] [-seed S] [-rounds R]\n"
+                        "       rtsim log [-n N] [-seed S] [-rounds R]\n");
+        return 2;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+        return usage();
+
+    Options opt = {-1, 1, 0, false, false, LOOP_US, 0, 0, -1, 0};
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            opt.n = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+            opt.seed = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-rounds") == 0 && i + 1 < argc)
+            opt.rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-realtime") == 0)
+            opt.realtime = true;
+        else if (strcmp(argv[i], "-tickless") == 0)
+            opt.tickless = true;
+        else if (strcmp(argv[i], "-idle") == 0 && i + 1 < argc)
+            opt.idle_ms = atol(argv[++i]);
+        else if (strcmp(argv[i], "-hold") == 0 && i + 1 < argc)
+            opt.hold_ms = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-loop") == 0 && i + 1 < argc)
+            opt.loop_us = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-pause") == 0 && i + 1 < argc) {
+            char *len = NULL;
+            opt.pause_at = strtoull(argv[++i], &len, 10);
+            if (*len != ':')
+                return usage();
+            opt.pause_len = strtoull(len + 1, NULL, 10);
+        }
+        else
+            return usage();
+    }
+    if (opt.rounds > 50)
+        opt.rounds = 50;
+
+    if (strcmp(argv[1], "session") == 0)
+        return cmd_session(opt);
+    if (strcmp(argv[1], "bench") == 0)
+        return cmd_bench(opt.n > 0 ? opt.n : 100000);
+    if (strcmp(argv[1], "edit") == 0)
+        return cmd_edit(opt);
+    if (strcmp(argv[1], "debounce") == 0)
+        return cmd_debounce(opt);
+    if (strcmp(argv[1], "keys") == 0)
+        return cmd_keys(opt);
+    if (strcmp(argv[1], "keypad") == 0)
+        return cmd_keypad(opt);
+    if (strcmp(argv[1], "rand") == 0)
+        return cmd_rand(opt);
+    if (strcmp(argv[1], "plan") == 0)
+        return cmd_plan(opt);
+    if (strcmp(argv[1], "timers") == 0)
+        return cmd_timers(opt);
+    if (strcmp(argv[1], "prog") == 0)
+        return cmd_prog(opt);
+    if (strcmp(argv[1], "log") == 0)
+        return cmd_log(opt);
+    if (strcmp(argv[1], "wear") == 0)
+        return cmd_wear(opt.n > 1 ? opt.n : 100000);
+
+    return usage();
+}
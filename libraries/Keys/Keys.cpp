@@ -1,55 +1,637 @@
 #include "Keys.h"
+#include <string.h>
+
+#if defined(__AVR__)
+	#include <avr/interrupt.h>
+#elif defined(RTIMER_HOST)
+	#include "hal.h"
+#endif
 
 using namespace keys;
 
-Key Keyboard::get_key() {
-  
-	KeyCode key = kcNone;
-            
-	uint16_t k = analogRead(kbd_port);
-	for (uint16_t i=0; i<MAX_KEYS; i++)
-		if (k < kresistor[i].resistance) {
-			key = kresistor[i].code;
+Keyboard * volatile Keyboard::sampler = NULL;
+volatile uint8_t Buttons::changes = 0;
+
+namespace {
+	// names of the keys up to kcRight, then of any matrix key, of any
+	// button and of an unknown code
+	const char K_NAMES[9][KEY_NAME_SIZE] PROGMEM = {
+		"NO_KEY", "SELECT", "LEFT", "UP", "DOWN", "RIGHT", "KEYPAD", "BUTTON", "UNKNOWN"
+	};
+
+	const char K_MODES[3][KEY_NAME_SIZE] PROGMEM = {"SNGL", "LONG", "DBL"};
+
+	// keys of the ladder from the lowest level on
+	const KeyCode LADDER[LADDER_KEYS] = {kcRight, kcUp, kcDown, kcLeft, kcSelect};
+
+	uint8_t ladder_pos(KeyCode code) {
+		for (uint8_t i = 0; i < LADDER_KEYS; i++)
+			if (LADDER[i] == code)
+				return i;
+
+		return LADDER_KEYS;
+	}
+
+	void reset_detector(Detector &d) {
+
+		d.key = {kcNone, kmSingle, 0};
+		d.deb_cand = kcNone;
+		d.deb_level = 0;
+		d.last_effective_key = kcNone;
+		d.last_key_time = 0;
+		d.last_ekey_time = 0;
+		d.repeats = 0;
+		d.next_repeat = 0;
+	}
+
+	// the earlier of two deadlines, also across the millis() rollover
+	unsigned long earlier(unsigned long a, unsigned long b) {
+
+		if (a == NO_DEADLINE)
+			return b;
+		if (b == NO_DEADLINE)
+			return a;
+
+		return long(a - b) < 0 ? a : b;
+	}
+}
+
+#if defined(RTIMER_HOST)
+namespace {
+	uint16_t host_port;
+}
+#endif
+
+//-------------------------------------------------------------------------------------------
+Backend::Backend() :
+	next(NULL) {
+
+	reset_detector(det);
+}
+
+//-------------------------------------------------------------------------------------------
+Ladder::Ladder(uint16_t port) :
+	port(port),
+	learn_code(kcNone) {
+
+	for (uint8_t i = 0; i < LADDER_KEYS; i++)
+		levels[i] = 0;
+	set_thresholds(DEFAULT_THRESHOLDS);
+}
+
+uint16_t Ladder::read() {
+
+	uint16_t a = analogRead(port),
+	         b = analogRead(port),
+	         c = analogRead(port);
+
+	return Keyboard::median(a, b, c);
+}
+
+bool Ladder::set_thresholds(const uint16_t th[LADDER_KEYS]) {
+
+	for (uint8_t i = 0; i < LADDER_KEYS; i++)
+		if (th[i] > 1023 || (i > 0 && th[i] <= th[i - 1]))
+			return false;
+
+	// an entry covers 1 << LUT_SHIFT ADC values and holds the key of their
+	// middle, the odd entries in the high nibbles
+	uint8_t table[LUT_SIZE / 2] = {0};
+	for (uint16_t e = 0; e < LUT_SIZE; e++) {
+		uint16_t v = (e << LUT_SHIFT) + (1 << LUT_SHIFT) / 2;
+		KeyCode key = kcNone;
+		for (uint8_t i = 0; i < LADDER_KEYS; i++)
+			if (v < th[i]) {
+				key = LADDER[i];
+				break;
+			}
+		table[e >> 1] |= key << ((e & 1) << 2);
+	}
+
+	// the sampling interrupt decodes with the table
+	noInterrupts();
+	memcpy(thresholds, th, sizeof(thresholds));
+	memcpy(lut, table, sizeof(lut));
+	interrupts();
+
+	return true;
+}
+
+void Ladder::get_thresholds(uint16_t th[LADDER_KEYS]) {
+
+	memcpy(th, thresholds, sizeof(thresholds));
+}
+
+void Ladder::learn(KeyCode code) {
+
+	noInterrupts();
+	learn_code = ladder_pos(code) < LADDER_KEYS ? code : kcNone;
+	learn_state = lsRelease;
+	interrupts();
+}
+
+uint16_t Ladder::get_level(KeyCode code) {
+
+	uint8_t i = ladder_pos(code);
+
+	return i < LADDER_KEYS ? levels[i] : 1023;
+}
+
+bool Ladder::calibrate() {
+
+	uint16_t th[LADDER_KEYS];
+	for (uint8_t i = 0; i < LADDER_KEYS; i++) {
+		uint16_t next = i + 1 < LADDER_KEYS ? levels[i + 1] : 1023;
+		if (next < levels[i] + LEARN_GAP)
+			return false;
+		th[i] = (levels[i] + next + 1) / 2;
+	}
+
+	return set_thresholds(th);
+}
+
+KeyCode Ladder::learn_sample(uint16_t adc, unsigned long now) {
+
+	bool pressed = adc < LEARN_IDLE;
+
+	switch (learn_state) {
+		case lsRelease:
+			if (!pressed)
+				learn_state = lsIdle;
+			break;
+
+		case lsIdle:
+			if (pressed) {
+				learn_state = lsPress;
+				learn_since = now;
+				learn_sum = 0;
+				learn_count = 0;
+			}
+			break;
+
+		case lsPress:
+			if (pressed) {
+				// the samples of the contact bounce are left out
+				if (now - learn_since >= DEBOUNCE_TOUT && learn_count < 0xFFFF) {
+					learn_sum += adc;
+					learn_count++;
+				}
+				break;
+			}
+			if (learn_count < LEARN_SAMPLES) {
+				learn_state = lsIdle;
+				break;
+			}
+
+			KeyCode code = learn_code;
+			levels[ladder_pos(code)] = (learn_sum + learn_count / 2) / learn_count;
+			learn_code = kcNone;
+
+			return code;
+	}
+
+	return kcNone;
+}
+
+//-------------------------------------------------------------------------------------------
+Matrix::Matrix(const uint8_t *rpins, uint8_t nrows, const uint8_t *cpins, uint8_t ncols) :
+	rows(nrows < MATRIX_MAX ? nrows : MATRIX_MAX),
+	cols(ncols < MATRIX_MAX ? ncols : MATRIX_MAX),
+	row(0) {
+
+	memcpy(row_pins, rpins, rows);
+	memcpy(col_pins, cpins, cols);
+}
+
+void Matrix::begin() {
+
+	for (uint8_t c = 0; c < cols; c++)
+		pinMode(col_pins[c], INPUT_PULLUP);
+	for (uint8_t r = 0; r < rows; r++)
+		pinMode(row_pins[r], INPUT);
+
+	row = 0;
+	for (uint8_t r = 0; r < MATRIX_MAX; r++)
+		row_keys[r] = kcNone;
+	if (rows > 0) {
+		digitalWrite(row_pins[row], LOW);
+		pinMode(row_pins[row], OUTPUT);
+	}
+}
+
+void Matrix::end() {
+
+	for (uint8_t r = 0; r < rows; r++)
+		pinMode(row_pins[r], INPUT);
+}
+
+bool Matrix::scan(KeyCode &key) {
+
+	if (rows == 0)
+		return false;
+
+	row_keys[row] = kcNone;
+	for (uint8_t c = 0; c < cols; c++)
+		if (digitalRead(col_pins[c]) == LOW) {
+			row_keys[row] = KeyCode(kcMatrix + row * cols + c);
+			break;
+		}
+
+	// the released row floats, so two keys of a column never short the rows
+	pinMode(row_pins[row], INPUT);
+	if (++row == rows)
+		row = 0;
+	digitalWrite(row_pins[row], LOW);
+	pinMode(row_pins[row], OUTPUT);
+
+	key = kcNone;
+	for (uint8_t r = 0; r < rows && key == kcNone; r++)
+		key = row_keys[r];
+
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+Buttons::Buttons(const uint8_t *bpins, uint8_t n, bool use_pcint) :
+	count(n < BUTTONS_MAX ? n : BUTTONS_MAX),
+	pcint(use_pcint),
+	seen(0) {
+
+	memcpy(pins, bpins, count);
+}
+
+void Buttons::begin() {
+
+	for (uint8_t i = 0; i < count; i++) {
+		pinMode(pins[i], INPUT_PULLUP);
+#if defined(__AVR__)
+		volatile uint8_t *msk = digitalPinToPCMSK(pins[i]);
+		if (pcint && msk != NULL) {
+			*msk |= _BV(digitalPinToPCMSKbit(pins[i]));
+			PCICR |= _BV(digitalPinToPCICRbit(pins[i]));
+		}
+#endif
+	}
+#if defined(RTIMER_HOST)
+	if (pcint)
+		hal::attach_pin_change(on_change);
+#endif
+
+	// the first scan reads the pins whatever they are
+	seen = changes - 1;
+}
+
+void Buttons::end() {
+
+	if (!pcint)
+		return;
+
+#if defined(__AVR__)
+	for (uint8_t i = 0; i < count; i++) {
+		volatile uint8_t *msk = digitalPinToPCMSK(pins[i]);
+		if (msk != NULL)
+			*msk &= ~_BV(digitalPinToPCMSKbit(pins[i]));
+	}
+#elif defined(RTIMER_HOST)
+	hal::detach_pin_change(on_change);
+#endif
+}
+
+bool Buttons::idle() {
+
+	return pcint && seen == changes;
+}
+
+bool Buttons::scan(KeyCode &key) {
+
+	seen = changes;
+
+	key = kcNone;
+	for (uint8_t i = 0; i < count; i++)
+		if (digitalRead(pins[i]) == LOW) {
+			key = KeyCode(kcButton + i);
 			break;
 		}
-  
-	// debounce key
-	if ( last_key.code != key && millis() - last_getkey_time < DEBOUNCE_TOUT )
+
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+char* Keyboard::get_key_code_name(KeyCode code, char name[KEY_NAME_SIZE]) {
+
+	uint8_t i = 8;
+	if ( code >= kcNone && code <= kcRight )
+		i = code;
+	else if ( code >= kcButton && code <= kcLastCode )
+		i = 7;
+	else if ( code >= kcMatrix && code < kcButton )
+		i = 6;
+
+	return (char*)memcpy_P(name, K_NAMES[i], KEY_NAME_SIZE);
+}
+
+char* Keyboard::get_key_mode_name(KeyMode mode, char name[KEY_NAME_SIZE]) {
+
+	return (char*)memcpy_P(name, K_MODES[mode <= kmDouble ? mode : kmSingle], KEY_NAME_SIZE);
+}
+
+//-------------------------------------------------------------------------------------------
+Keyboard::Keyboard(uint16_t kport, TimeSource time_src) :
+	ladder(kport),
+	backends(NULL),
+	now(time_src),
+	ev_head(0),
+	ev_tail(0),
+	lost_events(0),
+	deb_samples(DEBOUNCE_SAMPLES),
+	last_sample(0),
+	rep_delay(REPEAT_DELAY),
+	rep_rate(REPEAT_RATE),
+	rep_min_rate(REPEAT_MIN_RATE),
+	rep_accel(REPEAT_ACCEL) {
+
+	last_key = {kcNone, kmSingle, 0};
+}
+
+void Keyboard::add(Backend &b) {
+
+	b.begin();
+
+	// the sampling interrupt walks the list
+	noInterrupts();
+	b.next = backends;
+	backends = &b;
+	interrupts();
+}
+
+Key Keyboard::get_key() {
+
+	// a sample per ms at most, so the debounce takes as long as when sampling
+	if (now() == last_sample)
 		return last_key;
+	last_sample = now();
+
+	tick(ladder.read(), false);
+
+	return last_key;
+}
+
+bool Keyboard::begin_sampling() {
+
+	if (sampler != NULL)
+		return sampler == this;
+
+	ev_head = ev_tail = 0;
+	sampler = this;
+
+#if defined(__AVR__)
+	// AVcc reference, 125 kHz ADC clock, conversions auto-triggered by
+	// the Timer0 overflow. The millis() interrupt clears the overflow flag,
+	// so every overflow starts a new conversion
+	ADMUX = _BV(REFS0) | (ladder.get_port() & 0x07);
+	ADCSRB = _BV(ADTS2);
+	ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+#elif defined(RTIMER_HOST)
+	host_port = ladder.get_port();
+	hal::attach_isr(on_adc, SAMPLE_US);
+#endif
+
+	return true;
+}
+
+void Keyboard::end_sampling() {
+
+	if (sampler != this)
+		return;
+
+#if defined(__AVR__)
+	// back to single conversions analogRead() expects
+	ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+	ADCSRB = 0;
+#elif defined(RTIMER_HOST)
+	hal::detach_isr(on_adc);
+#endif
+
+	sampler = NULL;
+}
+
+void Keyboard::on_adc() {
+
+#if defined(__AVR__)
+	// the trigger starts a burst of OVERSAMPLE conversions, about 104 us each
+	static uint16_t burst[OVERSAMPLE];
+	static uint8_t n = 0;
+
+	burst[n++] = ADC;
+	if (n < OVERSAMPLE) {
+		ADCSRA |= _BV(ADSC);
+		return;
+	}
+	n = 0;
+
+	on_sample(median(burst[0], burst[1], burst[2]));
+#elif defined(RTIMER_HOST)
+	// the simulated ADC converts the whole burst at once
+	uint16_t a = analogRead(host_port),
+	         b = analogRead(host_port),
+	         c = analogRead(host_port);
+
+	on_sample(median(a, b, c));
+#endif
+}
+
+void Keyboard::on_sample(uint16_t adc) {
+
+	Keyboard *kbd = sampler;
+	if (kbd == NULL)
+		return;
+
+	kbd->tick(adc, true);
+}
+
+void Keyboard::tick(uint16_t adc, bool queue) {
+
+	if (ladder.is_learning()) {
+		KeyCode code = ladder.learn_sample(adc, now());
+		if (code != kcNone) {
+			push_event({code, kmSingle, 0});
+			push_event({kcNone, kmSingle, 0});
+			reset_detector(ladder.det);
+			last_key = ladder.det.key;
+		}
+	}
+	else
+		detect(ladder.det, ladder.decode(adc), queue);
+
+	for (Backend *b = backends; b != NULL; b = b->next) {
+		if (b->idle() && b->det.key.code == kcNone && b->det.deb_level == 0)
+			continue;
+
+		KeyCode code;
+		if (b->scan(code))
+			detect(b->det, code, queue);
+	}
+}
+
+void Keyboard::detect(Detector &d, KeyCode code, bool queue) {
+
+	Key prev = d.key,
+	    key = update(d, code);
+	if (key.code == prev.code && key.mode == prev.mode && key.repeats == prev.repeats)
+		return;
+
+	last_key = key;
+	if (queue)
+		push_event(key);
+}
+
+void Keyboard::push_event(Key key) {
+
+	uint8_t h = ev_head,
+	        next = (h + 1) & (KEY_EVENTS - 1);
+
+	if (next == ev_tail) {
+		lost_events++;
+		return;
+	}
+
+	events[h].key = key;
+	events[h].time = now();
+	ev_head = next;
+}
+
+KeyCode Keyboard::debounce(Detector &d, KeyCode key) {
+
+	if (key == d.key.code) {
+		if (d.deb_level > 0)
+			d.deb_level--;
+
+		return key;
+	}
+
+	// another new key starts over
+	if (key != d.deb_cand || d.deb_level == 0) {
+		d.deb_cand = key;
+		d.deb_level = 0;
+	}
+	if (++d.deb_level < deb_samples)
+		return d.key.code;
+
+	d.deb_level = 0;
+
+	return key;
+}
+
+void Keyboard::set_repeat(uint16_t delay, uint16_t rate, uint16_t min_rate, uint8_t accel) {
+
+	noInterrupts();
+	rep_delay = delay;
+	rep_rate = rate;
+	rep_min_rate = min_rate < rate ? min_rate : rate;
+	rep_accel = accel > 0 ? accel : 1;
+	interrupts();
+}
+
+uint16_t Keyboard::repeat_interval(Detector &d) {
+
+	uint16_t steps = d.repeats / rep_accel;
+	if (steps > 15)
+		return rep_min_rate;
 
-	last_getkey_time = millis();
+	uint16_t interval = rep_rate >> steps;
+
+	return interval > rep_min_rate ? interval : rep_min_rate;
+}
+
+bool Keyboard::get_event(KeyEvent &ev) {
+
+	uint8_t t = ev_tail;
+	if (t == ev_head)
+		return false;
+
+	ev = events[t];
+	ev_tail = (t + 1) & (KEY_EVENTS - 1);
+
+	return true;
+}
+
+Key Keyboard::update(Detector &d, KeyCode code) {
+
+	KeyCode key = debounce(d, code);
 
 	if (key == kcNone) {
-		if (last_key.code != kcNone) {
-			last_effective_key = last_key.code;
-			last_ekey_time = millis();
+		if (d.key.code != kcNone) {
+			d.last_effective_key = d.key.code;
+			d.last_ekey_time = now();
 		}
-		last_key_time = 0;
-		last_key = {kcNone, kmSingle};
+		d.last_key_time = 0;
+		d.key = {kcNone, kmSingle, 0};
 
-		return last_key;
+		return d.key;
 	}
 
-	if (last_key.code == kcNone) {
-		last_key_time = millis();
+	if (d.key.code == kcNone) {
+		d.last_key_time = now();
 		// check for double press
-		if (millis() - last_ekey_time < DBL_CLICK_TOUT && last_effective_key == key) {
-			last_key = {key, kmDouble};
-		  
-			return last_key;
+		if (now() - d.last_ekey_time < DBL_CLICK_TOUT && d.last_effective_key == key) {
+			d.key = {key, kmDouble, 0};
+
+			return d.key;
 		}
 	}
 
-	if (key == last_key.code) {
+	if (key == d.key.code) {
 		// check for long press
-		if (last_key_time != 0 && millis() - last_key_time >= LONG_PRESS_TOUT) {
-			last_key.mode = kmLong;
+		if (d.last_key_time != 0 && now() - d.last_key_time >= LONG_PRESS_TOUT) {
+			if (d.key.mode != kmLong) {
+				d.key.mode = kmLong;
+				d.key.repeats = 0;
+				d.repeats = 0;
+				d.next_repeat = now() + rep_delay;
+			}
+			else if (rep_rate != 0 && long(now() - d.next_repeat) >= 0) {
+				// counted from now, so a late reader gets one repeat, not a burst
+				d.repeats++;
+				d.key.repeats = uint8_t(d.repeats);
+				d.next_repeat = now() + repeat_interval(d);
+			}
 
-			return last_key;   
+			return d.key;
 		}
 	}
 
-	last_key = {key, kmSingle};
+	d.key = {key, kmSingle, 0};
 
-	return last_key;
-}
\ No newline at end of file
+	return d.key;
+}
+
+unsigned long Keyboard::deadline(Detector &d) {
+
+	unsigned long next = NO_DEADLINE;
+
+	if ( d.deb_level > 0 )
+		next = now() + 1;
+
+	if ( d.key.code != kcNone && d.key.mode != kmLong && d.last_key_time != 0 )
+		next = earlier(next, d.last_key_time + LONG_PRESS_TOUT);
+
+	if ( d.key.code != kcNone && d.key.mode == kmLong && rep_rate != 0 )
+		next = earlier(next, d.next_repeat);
+
+	return next;
+}
+
+unsigned long Keyboard::next_deadline() {
+
+	if ( ev_tail != ev_head )
+		return now();
+
+	// the detection state could be changed by the sampling interrupt meanwhile
+	noInterrupts();
+	unsigned long next = deadline(ladder.det);
+	for (Backend *b = backends; b != NULL; b = b->next)
+		next = earlier(next, deadline(b->det));
+	interrupts();
+
+	return next;
+}
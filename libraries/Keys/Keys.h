@@ -13,6 +13,8 @@
 	#include "Arduino.h"
 #elif defined(__arm__)
 	#include "Arduino.h"
+#elif defined(RTIMER_HOST)
+	#include "Arduino.h"
 #endif
 
 
@@ -25,10 +27,68 @@ namespace keys {
 		MAX_KEYS = 6;
 	
 	const uint64_t 
-	  DEBOUNCE_TOUT = 20,
+	  DEBOUNCE_TOUT = 20,   // contact bounce left out of a learned press
 	  DBL_CLICK_TOUT = 300,
 	  LONG_PRESS_TOUT = 500;
 
+	// Debounce. A sample is the median of OVERSAMPLE conversions, so a single
+	// glitch never reaches the decoding. A new key is taken after its samples
+	// outnumber the others by DEBOUNCE_SAMPLES: every sample of it counts up,
+	// every sample of the current key counts down
+	const uint8_t
+	  OVERSAMPLE = 3,
+	  DEBOUNCE_SAMPLES = 5;
+
+	// Auto-repeat of a held key. The first repeat comes REPEAT_DELAY ms after
+	// the long press, the next ones every REPEAT_RATE ms. The interval halves
+	// every REPEAT_ACCEL repeats down to REPEAT_MIN_RATE ms
+	const uint16_t
+	  REPEAT_DELAY = 200,
+	  REPEAT_RATE = 200,
+	  REPEAT_MIN_RATE = 25;
+	const uint8_t REPEAT_ACCEL = 8;
+
+	// Millisecond clock the keyboard reads time from. millis() by default,
+	// but any monotonic source (e.g. a simulated one) could be used
+	typedef unsigned long (*TimeSource)();
+
+	// Deadline value for "nothing is scheduled"
+	const unsigned long NO_DEADLINE = ~0UL;
+
+	// Room for the name of a key or a key mode with its terminating zero
+	const uint8_t KEY_NAME_SIZE = 8;
+
+	// Size of the key events queue, should be a power of 2
+	const uint8_t KEY_EVENTS = 8;
+
+	// Keys of the resistor ladder, from the lowest ADC level to the highest.
+	// A threshold is the level the key's range ends at
+	const uint8_t LADDER_KEYS = 5;
+	const uint16_t DEFAULT_THRESHOLDS[LADDER_KEYS] = {50, 150, 350, 500, 850};
+
+	// The key of an ADC value is read from a table of 1024 >> LUT_SHIFT entries,
+	// two 4-bit ones a byte
+	const uint8_t LUT_SHIFT = 3;
+	const uint16_t LUT_SIZE = 1024 >> LUT_SHIFT;
+
+	// Calibration: a key is learned from a press of LEARN_SAMPLES samples at
+	// least, a press is any level under LEARN_IDLE. Neighbour levels have to be
+	// LEARN_GAP apart
+	const uint16_t
+		LEARN_IDLE = 960,
+		LEARN_SAMPLES = 16,
+		LEARN_GAP = 16;
+
+	// In sampling mode the ADC conversions are started by the Timer0 overflow
+	// which also drives millis(), so there is a sample every 1.024 ms and the
+	// CPU isn't woken up by conversions nobody needs
+	const uint16_t SAMPLE_US = 1024;
+
+	// Largest matrix keypad and the number of single buttons a backend scans
+	const uint8_t
+		MATRIX_MAX = 4,
+		BUTTONS_MAX = 8;
+
 	typedef 
 		enum {
 			kcNone = 0,
@@ -36,7 +96,12 @@ namespace keys {
 			kcLeft,
 			kcUp,
 			kcDown,
-			kcRight
+			kcRight,
+			// key (row, col) of a matrix keypad is kcMatrix + row * cols + col
+			kcMatrix = 8,
+			// button n of the single buttons is kcButton + n
+			kcButton = kcMatrix + MATRIX_MAX * MATRIX_MAX,
+			kcLastCode = kcButton + BUTTONS_MAX - 1
 		} KeyCode;
 				 
 	  					   
@@ -47,69 +112,302 @@ namespace keys {
 			kmDouble
 		} KeyMode;
 						  
+	// A held key is kmLong and its repeats counts the auto-repeats since
+	// the long press, so every repeat is a new key state
 	typedef 
 		struct {
 			KeyCode code;
 			KeyMode mode;
+			uint8_t repeats;
 		} Key;
 
+	// Change of the keyboard state and the time it was detected
+	typedef
+		struct {
+			Key key;
+			unsigned long time;
+		} KeyEvent;
+
+	// Key detection state of a single source: debounce, double click,
+	// long press and auto-repeat. Every backend has its own, so a key
+	// held on one of them doesn't disturb the others
+	typedef
+		struct {
+			Key key;
+			KeyCode deb_cand;       // the key being debounced
+			uint8_t deb_level;      // its samples over the current key's ones
+			uint8_t last_effective_key;
+			unsigned long last_key_time;
+			unsigned long last_ekey_time;
+			uint16_t repeats;       // auto-repeats of the held key
+			unsigned long next_repeat;
+		} Detector;
+
+	//-------------------------------------------------------------------------------------------
+	// Source of keys scanned by the keyboard on every tick (a sample in
+	// sampling mode, a get_key() call otherwise). A scan should take a few
+	// microseconds since in sampling mode it runs in the ADC interrupt
+	class Backend {
+		public:
+			Backend();
+			virtual ~Backend() {};
+
+			// Takes the pins, called by Keyboard::add()
+			virtual void begin() {};
+			virtual void end() {};
+
+			// One step of the scan. True when key holds a complete reading of
+			// the pressed key (kcNone if there is none)
+			virtual bool scan(KeyCode &key) = 0;
+			// True while nothing could have changed since the last scan, so
+			// the keyboard skips it once the key is released
+			virtual bool idle() { return false; };
+
+		private:
+			friend class Keyboard;
+
+			Detector det;
+			Backend *next;
+	};
+
 	//-------------------------------------------------------------------------------------------
+	// Resistive ladder on an analog pin. The keyboard's own ladder is fed by
+	// the sampling interrupt; an added one reads its pin with analogRead(),
+	// so it works in polled mode only
+	class Ladder : public Backend {
+		public:
+			Ladder(uint16_t port);
+
+			bool scan(KeyCode &key) { key = decode(read()); return true; };
+			// Median of OVERSAMPLE conversions
+			uint16_t read();
+			uint16_t get_port() { return port; };
+
+			// The key of an ADC value, a single table read
+			KeyCode decode(uint16_t adc) {
+				uint8_t e = adc >> LUT_SHIFT;
+
+				return adc < 1024 ? KeyCode(lut[e >> 1] >> ((e & 1) << 2) & 0x0F) : kcNone;
+			};
+
+			// Thresholds in the ladder order (RIGHT, UP, DOWN, LEFT, SELECT).
+			// set_thresholds() rebuilds the decoding table and returns false,
+			// keeping the old ones, if they don't rise
+			bool set_thresholds(const uint16_t th[LADDER_KEYS]);
+			void get_thresholds(uint16_t th[LADDER_KEYS]);
+
+			// Calibration, see Keyboard::learn()
+			void learn(KeyCode code);
+			bool is_learning() { return learn_code != kcNone; };
+			uint16_t get_level(KeyCode code);
+			bool calibrate();
+			// Takes a sample of the key being learned. Returns the key once
+			// its press is over, kcNone meanwhile
+			KeyCode learn_sample(uint16_t adc, unsigned long now);
+
+		private:
+			uint16_t port;
+			uint16_t thresholds[LADDER_KEYS];
+			uint8_t lut[LUT_SIZE / 2];
+
+			typedef
+				enum {
+					lsRelease,  // waits for the keys to be released
+					lsIdle,     // waits for a press
+					lsPress     // averages the press
+				} LearnState;
+
+			volatile KeyCode learn_code;
+			LearnState learn_state;
+			unsigned long learn_since;
+			uint32_t learn_sum;
+			uint16_t learn_count;
+			uint16_t levels[LADDER_KEYS];
+	};
+
+	//-------------------------------------------------------------------------------------------
+	// Matrix keypad of up to MATRIX_MAX x MATRIX_MAX keys. The columns are
+	// inputs with pull-ups, the rows are driven low one by one and left
+	// floating otherwise. Every scan reads the columns of the row driven by
+	// the previous one and moves on to the next row, so a row settles for a
+	// whole tick and a scan never waits. The reading is the first pressed
+	// key of the last read of every row, so it changes on the tick the row
+	// of a key is read
+	class Matrix : public Backend {
+		public:
+			Matrix(const uint8_t *row_pins, uint8_t rows, const uint8_t *col_pins, uint8_t cols);
+
+			void begin();
+			void end();
+			bool scan(KeyCode &key);
+
+		private:
+			uint8_t row_pins[MATRIX_MAX];
+			uint8_t col_pins[MATRIX_MAX];
+			uint8_t rows;
+			uint8_t cols;
+			uint8_t row;        // the row being driven
+			KeyCode row_keys[MATRIX_MAX];   // pressed key of every row
+	};
+
+	//-------------------------------------------------------------------------------------------
+	// Up to BUTTONS_MAX buttons between pins and ground, the pins have
+	// pull-ups. The first pressed one is taken. The buttons are read on every
+	// tick, unless pcint is set: then their pin change interrupts are enabled
+	// and idle buttons cost no reads. The library leaves the PCINT vectors to
+	// the sketch (other libraries, e.g. SoftwareSerial, want them too), so
+	// with pcint the sketch should call on_change() from its pin change
+	// handler, or put KEYS_PCINT_VECTORS() in if it has none
+	class Buttons : public Backend {
+		public:
+			Buttons(const uint8_t *pins, uint8_t count, bool pcint = false);
+
+			void begin();
+			void end();
+			bool scan(KeyCode &key);
+			bool idle();
+
+			// Pin change interrupt handler
+			static void on_change() { changes++; };
+
+		private:
+			uint8_t pins[BUTTONS_MAX];
+			uint8_t count;
+			bool pcint;
+			uint8_t seen;       // changes at the last scan
+
+			static volatile uint8_t changes;
+	};
+
+#if defined(__AVR__)
+	// Pin change vectors of the buttons, for a sketch which has no other use for them
+	#define KEYS_PCINT_VECTORS() \
+		ISR(PCINT0_vect) { keys::Buttons::on_change(); } \
+		ISR(PCINT1_vect, ISR_ALIASOF(PCINT0_vect)); \
+		ISR(PCINT2_vect, ISR_ALIASOF(PCINT0_vect))
+	// ADC vector of the sampling mode, for a sketch which has no other use for it
+	#define KEYS_ADC_VECTOR() \
+		ISR(ADC_vect) { keys::Keyboard::on_adc(); }
+#endif
+
+	//-------------------------------------------------------------------------------------------
+	// The keyboard of the shield's ladder and any added backends. Every source
+	// goes through its own key detection and their changes are merged into
+	// one state and one events queue
 	class Keyboard {
 		public:
-			Keyboard(uint16_t kport) :
-				kbd_port(kport) {};
+			Keyboard(uint16_t kport, TimeSource time_src = millis);
+			~Keyboard() { end_sampling(); };
 			
+			// Polls the keyboard. Shouldn't be used in sampling mode.
+			// Returns the latest change of any source
 			Key get_key();
-			
-			char* get_key_code_name(KeyCode code) {
-				static char unknwn[] = "UNKNOWN";
-				
-				if ( code >= kcNone && code <= kcRight )
-					return K_NAMES[code];
-				
-				return unknwn;
+
+			// Adds a source of keys and calls its begin(). The backend should
+			// live as long as the keyboard
+			void add(Backend &b);
+
+			// Sampling mode. The ADC converts the keyboard port on its own and
+			// its interrupt feeds the key detection at a fixed rate. Every change
+			// of the key is put into the events queue, so no press is lost
+			// however rarely the queue is read. Only one keyboard could
+			// sample at a time. The ADC isn't available for analogRead()
+			// while sampling goes on. The sketch provides the ADC vector,
+			// see on_adc()
+			bool begin_sampling();
+			void end_sampling();
+			bool is_sampling() { return sampler == this; };
+
+			// Samples a new key needs to be taken, see DEBOUNCE_SAMPLES
+			void set_debounce(uint8_t samples) { deb_samples = samples > 0 ? samples : 1; };
+
+			// Auto-repeat timing of a held key, see REPEAT_DELAY. The rate is
+			// kept by the key's time, not by how often the keyboard is read,
+			// so a held key makes the same number of events on a busy loop.
+			// rate 0 turns the auto-repeat off
+			void set_repeat(uint16_t delay, uint16_t rate, uint16_t min_rate, uint8_t accel);
+
+			// Takes the oldest event from the queue
+			bool get_event(KeyEvent &ev);
+			bool has_events() { return ev_head != ev_tail; };
+			// Events dropped because the queue was full
+			uint16_t get_lost_events() { return lost_events; };
+
+			// The earliest moment get_key() could return another key while
+			// the inputs stay the same (debounce or long press timeouts).
+			// While a new key is being debounced it's the next sample.
+			// In sampling mode it's now() while there are events in the queue
+			unsigned long next_deadline();
+
+			// ADC conversion complete handler. It collects a burst and feeds
+			// its median to on_sample(). The library leaves the ADC vector to
+			// the sketch, as it does the PCINT ones: a sketch which samples
+			// should call on_adc() from its ADC handler, or put
+			// KEYS_ADC_VECTOR() in if it has none
+			static void on_adc();
+			// The key detection of a sample, adc is the median of a burst
+			static void on_sample(uint16_t adc);
+			static uint16_t median(uint16_t a, uint16_t b, uint16_t c) {
+				uint16_t lo = a < b ? a : b,
+				         hi = a < b ? b : a;
+
+				return c < lo ? lo : c > hi ? hi : c;
 			};
+
+			// The ladder's decoding, see Ladder
+			KeyCode decode(uint16_t adc) { return ladder.decode(adc); };
+			bool set_thresholds(const uint16_t th[LADDER_KEYS]) { return ladder.set_thresholds(th); };
+			void get_thresholds(uint16_t th[LADDER_KEYS]) { ladder.get_thresholds(th); };
+
+			// Calibration, sampling mode only. After learn(code) the keys are
+			// released and the next press is taken as code: the average of its
+			// samples becomes the code's level and the press is queued as code
+			// followed by kcNone. learn(kcNone) stops learning
+			void learn(KeyCode code) { ladder.learn(code); };
+			bool is_learning() { return ladder.is_learning(); };
+			uint16_t get_level(KeyCode code) { return ladder.get_level(code); };
+			// Puts the thresholds midway between the learned levels. False,
+			// keeping the old ones, if the levels aren't in the ladder order
+			bool calibrate() { return ladder.calibrate(); };
 			
-			char* get_key_mode_name(KeyMode mode) {
-				return K_MODES[mode];
-			}
+			// The names are kept in flash and copied into name, which is
+			// returned
+			static char* get_key_code_name(KeyCode code, char name[KEY_NAME_SIZE]);
+			static char* get_key_mode_name(KeyMode mode, char name[KEY_NAME_SIZE]);
 			
 		private:
-			uint16_t kbd_port;
+			Ladder ladder;
+			Backend *backends;
+			TimeSource now;
 
-			Key last_key;
-			uint8_t last_effective_key;
-			uint64_t last_getkey_time;
-			uint64_t last_key_time;
-			uint64_t last_ekey_time;
-			
-			char K_NAMES[6][10] = { "NO_KEY",
-							        "SELECT",
-							        "LEFT",
-							        "UP",
-							        "DOWN",
-							        "RIGHT" };
-					   
-			char K_MODES[3][5] = { "SNGL", 
-							       "LONG", 
-							       "DBL"};
-								   
-			typedef 
-				struct {
-					KeyCode code;
-					uint16_t resistance;
-				} KeyResistance;
-								   
-			KeyResistance kresistor[MAX_KEYS] = {
-				{kcRight,  50},
-				{kcUp,     150},
-				{kcDown,   350},
-				{kcLeft,   500},
-				{kcSelect, 850},
-				{kcNone,   1023}
-			};
+			static Keyboard * volatile sampler;
+
+			// Events queue. The interrupt moves the head, the reader moves the tail
+			KeyEvent events[KEY_EVENTS];
+			volatile uint8_t ev_head;
+			volatile uint8_t ev_tail;
+			volatile uint16_t lost_events;
+
+			// One tick of every source, adc is the ladder's sample
+			void tick(uint16_t adc, bool queue);
+			void detect(Detector &d, KeyCode code, bool queue);
+			// Key detection from a single sample of a source
+			Key update(Detector &d, KeyCode code);
+			KeyCode debounce(Detector &d, KeyCode key);
+			void push_event(Key key);
+			uint16_t repeat_interval(Detector &d);
+			unsigned long deadline(Detector &d);
+
+			Key last_key;           // the latest change of any source
+			uint8_t deb_samples;
+			unsigned long last_sample;
+
+			uint16_t rep_delay;
+			uint16_t rep_rate;
+			uint16_t rep_min_rate;
+			uint8_t rep_accel;
 	};
 };
 // end of namespace keys
 
-#endif // __KEYS_H__
\ No newline at end of file
+#endif // __KEYS_H__
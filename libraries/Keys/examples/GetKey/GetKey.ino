@@ -76,13 +76,14 @@ void display(char *str, uint8_t line) {
 void loop() {
  
 	display("Press any key...", 0);
-	char str[128];
+	char str[128],
+	     name[keys::KEY_NAME_SIZE];
 
 	keys::Key key = kbd.get_key();
 
-	strcpy(str, kbd.get_key_code_name(key.code));
+	strcpy(str, kbd.get_key_code_name(key.code, name));
 	strcat(str, " : ");
-	strcat(str, kbd.get_key_mode_name(key.mode));
+	strcat(str, kbd.get_key_mode_name(key.mode, name));
 
 	display(str, 1);
 }
\ No newline at end of file
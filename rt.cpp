@@ -2,32 +2,269 @@
 #include <EEPROM.h>
 
 
+namespace {
+
+    const char
+        S_MROOT[] PROGMEM = "MAIN MENU",
+        S_MROOT_DESCR[] PROGMEM = "Use UP/DOWN to choose Timer or Settings and SELECT to enter into it. ",
+        S_PTIMER[] PROGMEM = "MM>TIMER",
+        S_PTIMER_DESCR[] PROGMEM = "Press SELECT to run/stop timer",
+        S_MSETTINGS[] PROGMEM = "MM>SETTINGS",
+        S_MSETTINGS_DESCR[] PROGMEM = "Use UP/DOWN to choose settings and SELECT/RIGHT to configure it. Press LEFT to get back to main menu. ",
+        S_PTIMERSET[] PROGMEM = "SET>TMR",
+        S_PDELAYSET[] PROGMEM = "SET>DELAY",
+        S_PREPEATSET[] PROGMEM = "SET>RPT",
+        S_PBEEPSET[] PROGMEM = "SET>BEEPS",
+        S_PRESET[] PROGMEM = "SET>RESET",
+        S_PBKLITSET[] PROGMEM = "SET>BKLIT",
+        S_PKEYSSET[] PROGMEM = "SET>KEYS",
+        S_EMPTY[] PROGMEM = "",
+        S_SET_TIMER[] PROGMEM = "SET TMR: ",
+        S_SET_DELAY[] PROGMEM = "SET DELAY:",
+        S_SET_REPEAT[] PROGMEM = "SET RPT",
+        S_SET_BEEP[] PROGMEM = "SET CNTDWN BEEP",
+        S_SET_BKLIT[] PROGMEM = "SET BACKLIT",
+        S_CALIBRATE[] PROGMEM = "CALIBRATE KEYS",
+        S_CALIBRATED[] PROGMEM = "KEYS CALIBRATED",
+        S_CAL_FAIL[] PROGMEM = "CALIBRATION FAIL",
+        S_PRESS[] PROGMEM = "PRESS ",
+        S_PRESS_ANY[] PROGMEM = "PRESS ANY KEY",
+        S_FIX[] PROGMEM = "FIX ",
+        S_RND[] PROGMEM = "RND ",
+        S_NRM[] PROGMEM = "NRM ",
+        S_EXP[] PROGMEM = "EXP ",
+        S_FOREVER[] PROGMEM = ":FRV ",
+        S_TLIMIT[] PROGMEM = ":TIME ",
+        S_ROUNDS[] PROGMEM = ":RND ",
+        S_PROGRAM[] PROGMEM = ":PRG ",
+        S_MIN[] PROGMEM = "MIN: ",
+        S_MAX[] PROGMEM = "MAX: ",
+        S_START[] PROGMEM = "START:",
+        S_END[] PROGMEM = "END:",
+        S_ON[] PROGMEM = "ON",
+        S_OFF[] PROGMEM = "OFF",
+        S_YES[] PROGMEM = "YES",
+        S_NO[] PROGMEM = "NO",
+        S_RESET[] PROGMEM = "RESET?",
+        S_TIMER[] PROGMEM = "TIMER:",
+        S_TIMER_N[] PROGMEM = "T",
+        S_NOT_STARTED[] PROGMEM = "NOT STRTD ",
+        S_STARTS_IN[] PROGMEM = "STARTS IN:",
+        S_T_PAUSED[] PROGMEM = "T.PAUSED ",
+        S_D_PAUSED[] PROGMEM = "D.PAUSED ",
+        S_STARTED[] PROGMEM = "STARTED ",
+        S_DELAYED[] PROGMEM = "DELAYED ",
+        S_WARMUP[] PROGMEM = "WARM UP ",
+        S_BREAK[] PROGMEM = "BREAK ",
+        S_COOLDOWN[] PROGMEM = "COOL DOWN ",
+        // the stopped timer page's preview letter of every kind
+        S_KIND_LETTERS[] PROGMEM = "WDUBC";
+
+    // The running timer page's state of every Program::Kind in its order
+    const char *const S_KINDS[rtimer::Program::pkCount] PROGMEM = {
+        S_STARTED, S_DELAYED, S_WARMUP, S_BREAK, S_COOLDOWN
+    };
+
+    // Interval programs of the trmProgram mode, see Program for the bytecode
+    const uint8_t
+        // warm-up, 6 rounds, a break of 4 to 10 min, 6 shorter rounds, cool-down
+        PRG_SETS[] PROGMEM = {
+            PRG_FIX(pkWarmUp, 120),
+            PRG_REPEAT(6),
+                PRG_DRAW(pkWork, pmUniform, 30, 60), PRG_DRAW(pkRest, pmUniform, 10, 30),
+            PRG_NEXT,
+            PRG_DRAW(pkBreak, pmUniform, 240, 600),
+            PRG_REPEAT(6),
+                PRG_DRAW(pkWork, pmNormal, 20, 45), PRG_DRAW(pkRest, pmNormal, 10, 20),
+            PRG_NEXT,
+            PRG_FIX(pkCoolDown, 120),
+            PRG_END
+        },
+        // 3 blocks of 2 rounds and a 5 min break, mostly short works and now
+        // and then a long one
+        PRG_BLOCKS[] PROGMEM = {
+            PRG_REPEAT(3),
+                PRG_REPEAT(2),
+                    PRG_DRAW(pkWork, pmExp, 40, 90), PRG_FIX(pkRest, 15),
+                PRG_NEXT,
+                PRG_FIX(pkBreak, 300),
+            PRG_NEXT,
+            PRG_FIX(pkCoolDown, 90),
+            PRG_END
+        },
+        // tabata: 8 rounds of 20 s work and 10 s rest
+        PRG_TABATA[] PROGMEM = {
+            PRG_FIX(pkWarmUp, 60),
+            PRG_REPEAT(8),
+                PRG_FIX(pkWork, 20), PRG_FIX(pkRest, 10),
+            PRG_NEXT,
+            PRG_FIX(pkCoolDown, 60),
+            PRG_END
+        };
+
+    struct ProgramRef {
+        const uint8_t *code;
+        uint8_t len;
+    };
+
+    // The programs by their numbers on the repeat settings page, from 1
+    const ProgramRef PROGRAM_TABLE[rtimer::PROGRAMS] PROGMEM = {
+        {PRG_SETS, sizeof(PRG_SETS)},
+        {PRG_BLOCKS, sizeof(PRG_BLOCKS)},
+        {PRG_TABATA, sizeof(PRG_TABATA)}
+    };
+}
+
+
+//------------------------------------------------------------------------------------------
+// The menu graph, one entry per StepID in its order
+const rtimer::RTimer::Step rtimer::RTimer::STEPS[stCount] PROGMEM = {
+    // mRoot
+    { S_MROOT, S_MROOT_DESCR, mRoot, {pTimer, mSettings}, NULL, edNone},
+    // pTimer
+    { S_PTIMER, S_PTIMER_DESCR, mRoot, {}, &RTimer::timer_run, edNone},
+    // mSettings
+    { S_MSETTINGS, S_MSETTINGS_DESCR, mRoot, {pTimerSet, pDelaySet, pRepeatSet, pBeepSet, pBklitSet, pKeysSet, pReSet}, NULL, edNone},
+    // pTimerSet
+    { S_PTIMERSET, S_EMPTY, mSettings, {}, &RTimer::edit_run, edTimer},
+    // pDelaySet
+    { S_PDELAYSET, S_EMPTY, mSettings, {}, &RTimer::edit_run, edDelay},
+    // pRepeatSet
+    { S_PREPEATSET, S_EMPTY, mSettings, {}, &RTimer::edit_run, edRepeat},
+    // pBeepSet
+    { S_PBEEPSET, S_EMPTY, mSettings, {}, &RTimer::edit_run, edBeep},
+    // pReSet
+    { S_PRESET, S_EMPTY, mSettings, {}, &RTimer::set_reset_run, edNone},
+    // pBklitSet
+    { S_PBKLITSET, S_EMPTY, mSettings, {}, &RTimer::edit_run, edBacklit},
+    // pKeysSet
+    { S_PKEYSSET, S_EMPTY, mSettings, {}, &RTimer::set_keys_run, edNone}
+};
+
+
+//------------------------------------------------------------------------------------------
+// The editable settings, one entry per ParamID in its order
+const rtimer::RTimer::Param rtimer::RTimer::PARAMS[prCount] PROGMEM = {
+    // prTimerFix
+    { S_EMPTY, &RTimer::tmin, TIMER_MIN_DEFAULT, TIMER_MAX_DEFAULT, 1, 1, false},
+    // prTimerMin
+    { S_MIN, &RTimer::tmin, TIMER_MIN_DEFAULT, TIMER_MAX_DEFAULT, 1, 1, false},
+    // prTimerMax
+    { S_MAX, &RTimer::tmax, TIMER_MIN_DEFAULT, TIMER_MAX_DEFAULT, 1, 1, false},
+    // prDelayFix
+    { S_EMPTY, &RTimer::dmin, DELAY_MIN_DEFAULT, DELAY_MAX_DEFAULT, 1, 1, false},
+    // prDelayMin
+    { S_MIN, &RTimer::dmin, DELAY_MIN_DEFAULT, DELAY_MAX_DEFAULT, 1, 1, false},
+    // prDelayMax
+    { S_MAX, &RTimer::dmax, DELAY_MIN_DEFAULT, DELAY_MAX_DEFAULT, 1, 1, false},
+    // prTimeLimit, seconds
+    { S_EMPTY, &RTimer::trlimit, 2 * TIMER_MIN_DEFAULT, 255, 1, 5, false},
+    // prRounds
+    { S_EMPTY, &RTimer::trlimit, 1, 50, 1, 1, false},
+    // prProgram, the PROGRAM_TABLE entry from 1
+    { S_EMPTY, &RTimer::trlimit, 1, PROGRAMS, 1, 0, false},
+    // prStartBeep
+    { S_START, &RTimer::tstart_cntdwn, 0, 1, 1, 0, true},
+    // prEndBeep
+    { S_END, &RTimer::tend_cntdwn, 0, 1, 1, 0, true},
+    // prBacklit
+    { S_EMPTY, &RTimer::lcd_bklit, 5, 250, 5, 0, false}
+};
+
+
+//------------------------------------------------------------------------------------------
+// The settings pages, one entry per EditorID in its order
+const rtimer::RTimer::Editor rtimer::RTimer::EDITORS[edCount] PROGMEM = {
+    // edTimer
+    { S_SET_TIMER, &RTimer::tmode, 4, {S_FIX, S_RND, S_NRM, S_EXP},
+      {{prTimerFix, prNone}, {prTimerMin, prTimerMax}, {prTimerMin, prTimerMax}, {prTimerMin, prTimerMax}}, true},
+    // edDelay
+    { S_SET_DELAY, &RTimer::dmode, 4, {S_FIX, S_RND, S_NRM, S_EXP},
+      {{prDelayFix, prNone}, {prDelayMin, prDelayMax}, {prDelayMin, prDelayMax}, {prDelayMin, prDelayMax}}, true},
+    // edRepeat, in TimerRepeatMode order
+    { S_SET_REPEAT, &RTimer::trmode, 4, {S_FOREVER, S_TLIMIT, S_ROUNDS, S_PROGRAM},
+      {{prNone, prNone}, {prTimeLimit, prNone}, {prRounds, prNone}, {prProgram, prNone}}, false},
+    // edBeep
+    { S_SET_BEEP, NULL, 1, {},
+      {{prStartBeep, prEndBeep}}, false},
+    // edBacklit
+    { S_SET_BKLIT, NULL, 1, {},
+      {{prBacklit, prNone}}, false}
+};
+
+
 //------------------------------------------------------------------------------------------
-rtimer::RTimer::RTimer(const uint16_t lc_pins[6], const uint16_t keyboard_port, const uint8_t beep_port) :
-    kbd(keyboard_port),
-    lcd(lc_pins),
-    steps {  
-          { mRoot, "MAIN MENU", "Use UP/DOWN to choose Timer or Settings and SELECT to enter into it. ", mRoot, {pTimer, mSettings, mRoot, mRoot, mRoot, mRoot}, NULL},
-          { pTimer, "MM>TIMER", "Press SELECT to run/stop timer", mRoot, {}, &RTimer::timer_run},
-          { mSettings, "MM>SETTINGS", "Use UP/DOWN to choose settings and SELECT/RIGHT to configure it. Press LEFT to get back to main menu. ", mRoot, {pTimerSet, pDelaySet, pRepeatSet, pBeepSet, pBklitSet, pReSet}, NULL},
-          { pTimerSet, "SET>TMR", "", mSettings, {}, &RTimer::set_timer_run},
-          { pDelaySet, "SET>DELAY", "", mSettings, {}, &RTimer::set_delay_run},
-          { pRepeatSet, "SET>RPT", "", mSettings, {}, &RTimer::set_repeat_run},
-          { pBeepSet, "SET>BEEPS", "", mSettings, {}, &RTimer::set_beep_run},
-          { pBklitSet, "SET>BKLIT", "", mSettings, {}, &RTimer::set_bklit_run},
-          { pReSet, "SET>RESET", "", mSettings, {}, &RTimer::set_reset_run} },
+rtimer::RTimer::RTimer(const uint16_t lc_pins[6], const uint16_t keyboard_port, const uint8_t beep_port,
+                       keys::TimeSource time_src) :
+    now(time_src),
+    kbd(keyboard_port, time_src),
+    lcd(lc_pins, time_src),
+    events(time_src, LOG_RECORD, LOG_FIRST, LOG_SLOTS),
+    store(ConfigStore::VERSION, SETTINGS_FIRST, SETTINGS_SLOTS),
+    keys_store(KEYS_RECORD, KEYS_FIRST, KEYS_SLOTS),
     beeper(beep_port)
 {
+    for (uint8_t i = 0; i + 1 < TIMERS; i++)
+        timer_stores[i] = ConfigStore(TIMER_RECORD + i, TIMER_FIRST + i * TIMER_SLOTS,
+                                      TIMER_SLOTS);
+    for (uint8_t i = 0; i < TIMERS; i++) {
+        Timer &t = timers[i];
+        t.tstate = tsNotStarted;
+        t.next_tick = 0;
+        t.kind = Program::pkWork;
+        t.plan_valid = false;
+        t.plan_used = false;
+    }
+    sel = 0;
+    log_autosave = false;
+    log_pending = false;
+    cfg_dirty = 0;
+    timers_dirty = 0;
+    flush_at = 0;
+    save_idle = SAVE_IDLE;
+    key_new = false;
+    key_timed = false;
+    memset(key_latency, 0, sizeof(key_latency));
+    cal_key = keys::kcNone;
+    cal_result = crNone;
+    preview = 0;
+
     load();
-    randomSeed(analogRead(0));
+    load_keys();
+    curr_key.code = keys::kcNone;
+    curr_key.mode = keys::kmSingle;
+    curr_key.repeats = 0;
+
+    // budgets are in us. The UI one covers a settings save to the EEPROM
+    sched.add(&RTimer::keys_task, this, "keys", 100);
+    sched.add(&RTimer::scroll_task, this, "scroll", 500);
+    sched.add(&RTimer::engine_task, this, "engine", 500);
+    sched.add(&RTimer::ui_task, this, "ui", 4000, now());
+    sched.add(&RTimer::flush_task, this, "flush", 60000);
+    sched.add(&RTimer::plan_task, this, "plan", 1000);
+
+    power_on = now();
+    asleep_ms = 0;
+    asleep_us = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::begin()
+{
+    // the keyboard pin reads the same level while no key is pressed
+    rng.seed(Random::entropy(P_NOISE));
+
+    // from now on the keyboard is sampled by the ADC interrupt
+    kbd.begin_sampling();
 }
 
 
 //------------------------------------------------------------------------------------------
 void rtimer::RTimer::set_defaults() 
 {  
-    tstate = tsNotStarted;
-    last_millis = 0;
+    tick_drift = 0;
+    tick_drift_max = 0;
   
     tmode = tmRandom;
     tmin = TIMER_MIN_DEFAULT;
@@ -39,8 +276,15 @@ void rtimer::RTimer::set_defaults()
     
     trmode = trmRounds;
     trlimit = 3;
+
+    // every timer stops and gets the defaults
+    for (uint8_t i = 0; i < TIMERS; i++) {
+        set_state(i, tsNotStarted);
+        wheel.cancel(i);
+        to_timer(timers[i]);
+    }
     
-    rtValue = rtvMin;
+    edit_slot = 0;
     
     reset_flag = false;
   
@@ -58,43 +302,169 @@ void rtimer::RTimer::set_defaults()
 //------------------------------------------------------------------------------------------
 void rtimer::RTimer::load() 
 {
-    if ( EEPROM.read(0) == 73 ) { 
-      tmode = TimerMode(EEPROM.read(1));
-      tmin = EEPROM.read(2);
-      tmax = EEPROM.read(3);
-      dmode = TimerMode(EEPROM.read(4));
-      dmin = EEPROM.read(5);
-      dmax = EEPROM.read(6);
-      trmode = TimerRepeatMode(EEPROM.read(7));
-      trlimit = EEPROM.read(8);
-      tstart_cntdwn = bool(EEPROM.read(9));
-      tend_cntdwn = bool(EEPROM.read(10));
-      lcd_bklit = EEPROM.read(11);
-
-      lcd.changeBacklit(lcd_bklit);
-    }
-    else {
-      EEPROM.update(0, 73);
-      set_defaults();
-      save();
+    uint8_t cfg[ConfigStore::PAYLOAD_SIZE];
+
+    if (!store.load(cfg)) {
+        // settings of the older firmware: the magic 73 and the payload behind it
+        if (EEPROM.read(0) != 73) {
+            set_defaults();
+            save();
+            commit();
+            return;
+        }
+        for (uint8_t i = 0; i < ConfigStore::PAYLOAD_SIZE; i++)
+            cfg[i] = EEPROM.read(i + 1);
+        store.save(cfg);
     }
+
+    unpack_timer(cfg, timers[0]);
+    from_timer(timers[0]);
+    tstart_cntdwn = bool(cfg[8]);
+    tend_cntdwn = bool(cfg[9]);
+    lcd_bklit = cfg[10];
+
+    // a timer without settings of its own starts as a copy of the first one
+    for (uint8_t i = 1; i < TIMERS; i++)
+        if (timer_stores[i - 1].load(cfg))
+            unpack_timer(cfg, timers[i]);
+        else
+            to_timer(timers[i]);
+
+    lcd.changeBacklit(lcd_bklit);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::pack_timer(const Timer &t, uint8_t cfg[ConfigStore::PAYLOAD_SIZE])
+{
+    cfg[0] = t.tmode;
+    cfg[1] = t.tmin;
+    cfg[2] = t.tmax;
+    cfg[3] = t.dmode;
+    cfg[4] = t.dmin;
+    cfg[5] = t.dmax;
+    cfg[6] = t.trmode;
+    cfg[7] = t.trlimit;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::unpack_timer(const uint8_t cfg[ConfigStore::PAYLOAD_SIZE], Timer &t)
+{
+    t.tmode = cfg[0];
+    t.tmin = cfg[1];
+    t.tmax = cfg[2];
+    t.dmode = cfg[3];
+    t.dmin = cfg[4];
+    t.dmax = cfg[5];
+    t.trmode = cfg[6];
+    t.trlimit = cfg[7];
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::to_timer(Timer &t)
+{
+    t.tmode = tmode;
+    t.tmin = tmin;
+    t.tmax = tmax;
+    t.dmode = dmode;
+    t.dmin = dmin;
+    t.dmax = dmax;
+    t.trmode = trmode;
+    t.trlimit = trlimit;
+    t.plan_valid = false;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::from_timer(const Timer &t)
+{
+    tmode = t.tmode;
+    tmin = t.tmin;
+    tmax = t.tmax;
+    dmode = t.dmode;
+    dmin = t.dmin;
+    dmax = t.dmax;
+    trmode = t.trmode;
+    trlimit = t.trlimit;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::select_timer(uint8_t id)
+{
+    // the members are always saved to the selected timer, so they're just replaced
+    sel = id;
+    from_timer(timers[sel]);
+    preview = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::pack(uint8_t cfg[ConfigStore::PAYLOAD_SIZE])
+{
+    pack_timer(timers[0], cfg);
+    cfg[8] = uint8_t(tstart_cntdwn);
+    cfg[9] = uint8_t(tend_cntdwn);
+    cfg[10] = lcd_bklit;
 }
 
 
 //------------------------------------------------------------------------------------------
 void rtimer::RTimer::save() 
 {
-    EEPROM.update(1, uint8_t(tmode));
-    EEPROM.update(2, tmin);
-    EEPROM.update(3, tmax);
-    EEPROM.update(4, uint8_t(dmode));
-    EEPROM.update(5, dmin);
-    EEPROM.update(6, dmax);
-    EEPROM.update(7, uint8_t(trmode));
-    EEPROM.update(8, trlimit);
-    EEPROM.update(9, uint8_t(tstart_cntdwn));
-    EEPROM.update(10, uint8_t(tend_cntdwn));
-    EEPROM.update(11, lcd_bklit);
+    uint8_t cfg[ConfigStore::PAYLOAD_SIZE];
+    to_timer(timers[sel]);
+    pack(cfg);
+
+    // a value changed back and forth leaves nothing to write
+    cfg_dirty = store.diff(cfg);
+    // a timer which was never edited starts as a copy of the first one at
+    // power on, so it needs no record
+    memset(cfg, 0, sizeof(cfg));
+    for (uint8_t i = 1; i < TIMERS; i++) {
+        pack_timer(timers[i], cfg);
+        if ((i == sel || timer_stores[i - 1].has_record()) && timer_stores[i - 1].diff(cfg) != 0)
+            timers_dirty |= 1 << i;
+        else
+            timers_dirty &= ~(1 << i);
+    }
+    flush_at = now() + save_idle;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::commit() 
+{
+    uint8_t cfg[ConfigStore::PAYLOAD_SIZE];
+    if (cfg_dirty != 0) {
+        pack(cfg);
+        store.save(cfg);
+        cfg_dirty = 0;
+    }
+
+    memset(cfg, 0, sizeof(cfg));
+    for (uint8_t i = 1; i < TIMERS; i++)
+        if (timers_dirty & (1 << i)) {
+            pack_timer(timers[i], cfg);
+            timer_stores[i - 1].save(cfg);
+        }
+    timers_dirty = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::load_keys()
+{
+    uint8_t rec[ConfigStore::PAYLOAD_SIZE];
+    if (!keys_store.load(rec))
+        return;
+
+    uint16_t th[keys::LADDER_KEYS];
+    for (uint8_t i = 0; i < keys::LADDER_KEYS; i++)
+        th[i] = rec[2 * i] | uint16_t(rec[2 * i + 1]) << 8;
+    kbd.set_thresholds(th);
 }
 
 
@@ -110,19 +480,210 @@ void rtimer::RTimer::reset()
 //------------------------------------------------------------------------------------------
 void rtimer::RTimer::run()
 {
+    unsigned long t = now();
 
-    beeper.check_beeper();
-    
-    keys::Key key = kbd.get_key();
-  
-    // get current step info
-    RTimer::Step *step = get_step(curr_step);
-    if (step == NULL)
+    // key events come from the sampling interrupt
+    if (kbd.has_events())
+        sched.wake(tKeys, t);
+
+    unsigned long start = micros();
+    sched.run(t);
+
+    // a settings key is handled when the whole pass is over, whatever else
+    // (an EEPROM write) the pass had to do
+    if (key_timed) {
+        uint32_t took = micros() - start;
+        uint8_t b = 0;
+        while (b < LATENCY_BUCKETS - 1 && took >= (256UL << b))
+            b++;
+        key_latency[b]++;
+        key_timed = false;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::keys_task(void *ctx, unsigned long t)
+{
+    RTimer *rt = static_cast<RTimer*>(ctx);
+
+    if (!rt->kbd.is_sampling()) {
+        keys::Key k = rt->kbd.get_key();
+        if (k.code != rt->curr_key.code || k.mode != rt->curr_key.mode ||
+            k.repeats != rt->curr_key.repeats) {
+            rt->curr_key = k;
+            rt->key_new = true;
+            rt->sched.wake(tUI, t);
+        }
+
+        return t + 1;
+    }
+
+    // one event per UI run, so even a short press is seen by the runners
+    keys::KeyEvent ev;
+    if (rt->kbd.get_event(ev)) {
+        rt->events.key(ev.key.code, ev.key.mode);
+        rt->curr_key = ev.key;
+        rt->key_new = true;
+        rt->sched.wake(tUI, t);
+    }
+
+    return keys::NO_DEADLINE;
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::scroll_task(void *ctx, unsigned long)
+{
+    RTimer *rt = static_cast<RTimer*>(ctx);
+
+    rt->lcd.scrollLines();
+
+    return rt->lcd.next_deadline();
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::engine_task(void *ctx, unsigned long)
+{
+    return static_cast<RTimer*>(ctx)->timer_engine();
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::ui_task(void *ctx, unsigned long t)
+{
+    RTimer *rt = static_cast<RTimer*>(ctx);
+
+    StepID from = rt->curr_step;
+    rt->key_timed = rt->key_new && rt->is_settings(from);
+
+    rt->step(rt->curr_key);
+    rt->key_new = false;
+    rt->show();
+
+    // the edits are written once the settings page is left or the editing pauses
+    if (rt->is_settings(from) && rt->curr_step != from)
+        rt->flush_at = t;
+    if (rt->is_dirty())
+        rt->sched.wake(tFlush, rt->flush_at);
+
+    // the key could have started, paused or stopped the timer or changed the lines
+    rt->sched.wake(tEngine, rt->engine_deadline());
+    rt->sched.wake(tScroll, rt->lcd.next_deadline());
+
+    return keys::NO_DEADLINE;
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::flush_task(void *ctx, unsigned long t)
+{
+    RTimer *rt = static_cast<RTimer*>(ctx);
+
+    // the log of a session over goes at once, the settings wait for the edits to end
+    if (rt->log_pending) {
+        rt->log_pending = false;
+        rt->events.save();
+    }
+
+    if (!rt->is_dirty())
+        return keys::NO_DEADLINE;
+
+    // every edit moves the flush further
+    if (long(t - rt->flush_at) < 0)
+        return rt->flush_at;
+
+    rt->commit();
+
+    return keys::NO_DEADLINE;
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::plan_task(void *ctx, unsigned long)
+{
+    RTimer *rt = static_cast<RTimer*>(ctx);
+
+    for (uint8_t i = 0; i < TIMERS; i++)
+        rt->timers[i].plan.fill();
+
+    return keys::NO_DEADLINE;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::compile(Timer &t)
+{
+    Program &p = t.prog;
+    p.clear();
+
+    // the last round ends with its work, a delay after it would lead nowhere
+    bool rounds = t.trmode == trmRounds;
+    if (!rounds || t.trlimit > 1) {
+        p.add_repeat(rounds ? t.trlimit - 1 : 0);
+        p.add_phase(Program::pkWork, t.tmode, t.tmin, t.tmax);
+        p.add_phase(Program::pkRest, t.dmode, t.dmin, t.dmax);
+        p.add_next();
+    }
+    if (rounds)
+        p.add_phase(Program::pkWork, t.tmode, t.tmin, t.tmax);
+    p.add_end();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::make_plan(Timer &t)
+{
+    if (t.trmode == trmProgram) {
+        ProgramRef ref;
+        memcpy_P(&ref, &PROGRAM_TABLE[t.trlimit >= 1 && t.trlimit <= PROGRAMS ? t.trlimit - 1 : 0],
+                 sizeof(ref));
+        t.prog.load_P(ref.code, ref.len);
+    }
+    else
+        compile(t);
+    t.plan.start(rng.next(), t.prog);
+    t.plan_valid = true;
+    t.plan_used = false;
+    preview = 0;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::show()
+{
+    uint8_t last_code = last_key_code;
+    keys::Key none;
+    none.code = keys::kcNone;
+    none.mode = keys::kmSingle;
+    none.repeats = 0;
+
+    step(none);
+    last_key_code = last_code;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::step(keys::Key key)
+{
+    if (curr_step >= stCount)
         return;
+
+    // get current step info
+    Step st;
+    get_step(curr_step, st);
+    const Step *step = &st;
   
-    if (key.code == keys::kcLeft) {
-        tstate = tsNotStarted;
+    // a held LEFT gets back only one step. The keys calibration takes
+    // LEFT as any other key
+    if (key.code == keys::kcLeft && key.code != last_key_code &&
+        cal_key == keys::kcNone && cal_result == crNone) {
+        // leaving the timer page stops the timer it shows, the others go on
+        set_state(sel, tsNotStarted);
+        wheel.cancel(sel);
         curr_step = step->prev;
+        last_key_code = key.code;
         return;
     }
 
@@ -133,14 +694,14 @@ void rtimer::RTimer::run()
         return;
     }
   
-    Step *stp = NULL;
-    if (step->next[curr_menu_item] != mRoot)
-      stp = get_step(step->next[curr_menu_item]);
-    if (stp)
-      lcd.showLine(stp->name, 0);
+    if (step->next[curr_menu_item] != mRoot) {
+      Step stp;
+      get_step(step->next[curr_menu_item], stp);
+      lcd.showLine_P(stp.name, 0);
+    }
     else
-      lcd.showLine(step->name, 0);
-    lcd.showLine(step->descr, 1);
+      lcd.showLine_P(step->name, 0);
+    lcd.showLine_P(step->descr, 1);
   
     if (key.code == last_key_code)
       return;
@@ -170,25 +731,124 @@ void rtimer::RTimer::run()
           else
               curr_menu_item--;
 
-          if (curr_menu_item < 0 || curr_menu_item > 5 || step->next[curr_menu_item] == mRoot)
+          if (curr_menu_item < 0 || curr_menu_item >= MENU_ITEMS || step->next[curr_menu_item] == mRoot)
             curr_menu_item = 0;
         break;
+
+      // the menu is driven by the shield's keys, a keypad or a button isn't bound
+      default:
+          break;
     }
   
 }
 
 
 //------------------------------------------------------------------------------------------
-rtimer::RTimer::LC::LC(const uint16_t lc_pins[6]) :
+unsigned long rtimer::RTimer::next_deadline()
+{
+    unsigned long next = kbd.next_deadline();
+
+    // the deadlines may lie on both sides of the millis() rollover
+    unsigned long dl = sched.next_deadline();
+    if (dl != keys::NO_DEADLINE && (next == keys::NO_DEADLINE || long(dl - next) < 0))
+        next = dl;
+
+    return next;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::sleep(unsigned long max_ms)
+{
+    if (kbd.has_events())
+        return;
+
+    // Key timeouts past due are resolved by the next sample, so the CPU sleeps
+    // at least until the next interrupt
+    unsigned long dl = next_deadline();
+    if (max_ms != keys::NO_DEADLINE) {
+        unsigned long cap = now() + max_ms;
+        if (dl == keys::NO_DEADLINE || long(cap - dl) < 0)
+            dl = cap;
+    }
+    unsigned long start = micros();
+    for (;;) {
+        noInterrupts();
+        hw::idle();
+
+        noInterrupts();
+        bool wake = kbd.has_events() || (dl != keys::NO_DEADLINE && long(now() - dl) >= 0);
+        interrupts();
+        if (wake)
+            break;
+    }
+
+    asleep_us += micros() - start;
+    asleep_ms += asleep_us / 1000;
+    asleep_us %= 1000;
+}
+
+
+//------------------------------------------------------------------------------------------
+rtimer::RTimer::Stats rtimer::RTimer::get_stats()
+{
+    Stats st;
+
+    st.lcd_writes = lcd.getWrites();
+    st.lcd_moves = lcd.getMoves();
+    st.lcd_queue_max = lcd.getQueueMax();
+    st.lcd_overflows = lcd.getOverflows();
+    st.keys_lost = kbd.get_lost_events();
+    st.beeps_lost = beeper.getDropped();
+    st.cfg_writes = store.get_writes();
+    for (uint8_t i = 0; i + 1 < TIMERS; i++)
+        st.cfg_writes += timer_stores[i].get_writes();
+    st.cfg_dirty = cfg_dirty;
+    memcpy(st.key_latency, key_latency, sizeof(key_latency));
+    st.tick_drift = tick_drift;
+    st.tick_drift_max = tick_drift_max;
+    st.awake_ms = now() - power_on - asleep_ms;
+    st.asleep_ms = asleep_ms;
+
+    return st;
+}
+
+
+//------------------------------------------------------------------------------------------
+rtimer::RTimer::LC::LC(const uint16_t lc_pins[6], keys::TimeSource time_src) :
   _lcd(lc_pins[0], lc_pins[1], lc_pins[2], lc_pins[3], lc_pins[4], lc_pins[5]),
+  now(time_src),
   display_tout(MIN_TOUT),
-  bklit(DISPLAY_BKLIT)
+  scroll {NULL, NULL},
+  scroll_P {false, false},
+  bklit(DISPLAY_BKLIT),
+  cur_col(0),
+  cur_row(0),
+  writes(0),
+  moves(0),
+  q_head(0),
+  q_tail(0),
+  q_max(0),
+  overflows(0)
 {
-    // init LCD display
-    _lcd.begin(16, 2);
+    for (uint8_t i = 0; i < 6; i++)
+        pins[i] = lc_pins[i];
+
+    // init LCD display. It's blank and the cursor is at home after begin()
+    _lcd.begin(LCD_COLS, 2);
+    memset(fb, ' ', sizeof(fb));
     
     // set backlit value
     changeBacklit(bklit);
+
+    hw::add_tick(&LC::on_tick, this);
+}
+
+
+//------------------------------------------------------------------------------------------
+rtimer::RTimer::LC::~LC()
+{
+    hw::remove_tick(&LC::on_tick, this);
 }
 
 
@@ -201,143 +861,354 @@ void rtimer::RTimer::LC::changeBacklit(uint8_t new_bl)
 }
 
 //------------------------------------------------------------------------------------------
-void rtimer::RTimer::LC::showLine(String str, uint8_t line) 
+void rtimer::RTimer::LC::show(const char *str, uint8_t line, bool flash) 
 {
     if (line > 1)
         return;
-  
-    if (lines[line] == str && lines[line].length() <= 16)
-        return;
 
-    if ( lines[line] != str ) {
-        lines[line] = str;
+    if (scroll[line] != str) {
+        size_t len = flash ? strlen_P(str) : strlen(str);
+        if (len <= LCD_COLS) {
+            scroll[line] = NULL;
+            draw(str, line, flash);
+            return;
+        }
+        // a new long text is shown at once, scrollLines() moves it later on
+        scroll[line] = str;
+        scroll_P[line] = flash;
+        scroll_len[line] = len > 255 ? 255 : len;
         pos[line] = 0;
+        draw(str, line, flash);
+        pos[line] = 1;
+        last_disp_time = now();
     }
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::LC::scrollLines()
+{
+    if ((scroll[0] == NULL && scroll[1] == NULL) || now() - last_disp_time < display_tout)
+        return;
 
-    _lcd.setCursor(0, line);
-    if (lines[line].length() > 16) {
-        if (millis() - last_disp_time >= display_tout) {
-            _lcd.print(lines[line].substring(pos[line], pos[line] + 16));
-            if (++pos[line] >= lines[line].length())    
+    for (uint8_t line = 0; line < 2; line++)
+        if (scroll[line] != NULL) {
+            draw(scroll[line] + pos[line], line, scroll_P[line]);
+            if (++pos[line] >= scroll_len[line])
                 pos[line] = 0;
-            last_disp_time = millis();
         }
-    }
-    else {
-        // clearing by spaces prevents of screen blinking after LiquidScreen::clear()
-        _lcd.print("                ");
-        _lcd.setCursor(0, line);
-        _lcd.print(lines[line]);
+    last_disp_time = now();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::LC::draw(const char *str, uint8_t line, bool flash)
+{
+    // the text is padded by spaces up to the display width. The controller
+    // moves the cursor after each character itself, so it's positioned only
+    // when the changed cells are not contiguous
+    for (uint8_t col = 0; col < LCD_COLS; col++) {
+        char c = flash ? pgm_read_byte(str) : *str;
+        if (c != 0)
+            str++;
+        else
+            c = ' ';
+        if (fb[line][col] == c)
+            continue;
+
+        // a cell which doesn't fit into the queue keeps its old value in fb
+        // and goes out with one of the next draws
+        if (queued() >= LCD_QUEUE - 2) {
+            overflows++;
+            return;
+        }
+
+        if (cur_row != line || cur_col != col) {
+            // set DDRAM address command, the second line starts at 0x40
+            enqueue(0x80 | (col + (line ? 0x40 : 0)), false);
+            cur_row = line;
+            moves++;
+        }
+        enqueue(uint8_t(c), true);
+        fb[line][col] = c;
+        cur_col = col + 1;
+        writes++;
     }
 }
 
 
 //------------------------------------------------------------------------------------------
-rtimer::RTimer::Beeper::Beeper(uint8_t bport) :
-    beeper_port(bport),
-    beeps{
-        {1500, 300},   // btStart
-        {1000, 300},   // btDelay
-        {1200, 100},   // btStartCntdwn
-        {800,  100},   // btEndCntdwn
-        {100,  500} }  // btEnd  
+void rtimer::RTimer::LC::enqueue(uint8_t value, bool data)
 {
-  stop_beep_millis = 0;
-  noTone(beeper_port);  
+    uint8_t h = q_head;
+
+    q_data[h] = value;
+    if (data)
+        q_rs[h >> 3] |= 1 << (h & 7);
+    else
+        q_rs[h >> 3] &= ~(1 << (h & 7));
+    q_head = (h + 1) & (LCD_QUEUE - 1);
+
+    if (queued() > q_max)
+        q_max = queued();
 }
+
+
 //------------------------------------------------------------------------------------------
+void rtimer::RTimer::LC::send(uint8_t value, bool data)
+{
+    // 4-bit transfer, high nibble first. The controller latches a nibble on the
+    // falling edge of enable. digitalWrite() is slow enough to keep the enable
+    // pulse wider than 450 ns, and the next byte comes a tick later, well after
+    // the 37 us the controller needs to execute this one
+    digitalWrite(pins[0], data ? HIGH : LOW);
+    for (uint8_t n = 0; n < 2; n++) {
+        uint8_t nibble = n == 0 ? value >> 4 : value;
+        for (uint8_t i = 0; i < 4; i++)
+            digitalWrite(pins[2 + i], (nibble >> i) & 1 ? HIGH : LOW);
+        digitalWrite(pins[1], HIGH);
+        digitalWrite(pins[1], LOW);
+    }
+}
 
 
-void rtimer::RTimer::Beeper::beep(TBeepType btype)
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::LC::on_tick(void *ctx)
 {
-    tone(beeper_port, beeps[btype].freq, beeps[btype].dur);
-    stop_beep_millis = millis() + beeps[btype].dur;
+    LC *lc = static_cast<LC*>(ctx);
+
+    uint8_t t = lc->q_tail;
+    if (t == lc->q_head)
+        return;
+
+    lc->send(lc->q_data[t], lc->q_rs[t >> 3] & (1 << (t & 7)));
+    lc->q_tail = (t + 1) & (LCD_QUEUE - 1);
 }
 
 
 //------------------------------------------------------------------------------------------
-void rtimer::RTimer::Beeper::check_beeper()
+unsigned long rtimer::RTimer::LC::next_deadline()
 {
-    if (stop_beep_millis > 0 && stop_beep_millis < millis()) {
-      noTone(beeper_port);
-      stop_beep_millis = 0;
-    }
+    // only lines longer than the display move on their own
+    if (scroll[0] != NULL || scroll[1] != NULL)
+        return last_disp_time + display_tout;
+
+    return keys::NO_DEADLINE;
 }
 
 
 //------------------------------------------------------------------------------------------
-bool rtimer::RTimer::timer_run(keys::Key k) 
+const rtimer::RTimer::Beeper::Note rtimer::RTimer::Beeper::NOTES[] PROGMEM = {
+    // freq, dur, wave, level, attack, release
+    {1500, 300, audio::wSine,   255, 10,  80},      // btStart
+    {1000, 300, audio::wSine,   255, 10,  80},      // btDelay
+    {1200, 100, audio::wSquare, 160,  2,  30},      // btStartCntdwn
+    {800,  100, audio::wSquare, 160,  2,  30},      // btEndCntdwn
+    {100,  150, audio::wSquare, 255,  5,  40},      // btEnd
+    {0,    100, audio::wSquare,   0,  0,   0},
+    {100,  150, audio::wSquare, 255,  5,  40},
+    {0,    100, audio::wSquare,   0,  0,   0},
+    {100,  300, audio::wSquare, 255,  5, 150},
+    {0,    120, audio::wSquare,   0,  0,   0}       // GAP
+};
+
+const rtimer::RTimer::Beeper::Pattern rtimer::RTimer::Beeper::PATTERNS[] PROGMEM = {
+    {0, 1},     // btStart
+    {1, 1},     // btDelay
+    {2, 1},     // btStartCntdwn
+    {3, 1},     // btEndCntdwn
+    {4, 5}      // btEnd
+};
+
+const uint8_t rtimer::RTimer::Beeper::GAP = 9;
+
+// unison, a minor third (7/6) and a fourth (4/3)
+const uint16_t rtimer::RTimer::Beeper::PITCH[] PROGMEM = {256, 299, 341};
+
+
+//------------------------------------------------------------------------------------------
+rtimer::RTimer::Beeper::Beeper(uint8_t bport) :
+    beeper_port(bport),
+    q_head(0),
+    q_tail(0),
+    dropped(0),
+    playing(false),
+    left_us(0),
+    release_us(0),
+    env(0),
+    env_top(0),
+    env_step(0),
+    stage(esAttack)
 {
-    String fStr("TIMER:"),
-           sStr("");
-    switch (tstate) {
-        case tsNotStarted:
-            fStr += "NOT STRTD ";
-            break;
-  
-        case tsStartCntdwn:
-            fStr += "STARTS IN:";
-            sStr = start_cntdwn;
-            break;
-        
-        case tsStarted:
-            fStr += "STARTED ";
-            sStr += tleft;
+    audio::begin(beeper_port);
+
+    hw::add_tick(&Beeper::on_tick, this);
+}
+
+
+//------------------------------------------------------------------------------------------
+rtimer::RTimer::Beeper::~Beeper()
+{
+    hw::remove_tick(&Beeper::on_tick, this);
+    audio::end();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::Beeper::beep(TBeepType btype, uint8_t voice)
+{
+    Pattern p;
+    memcpy_P(&p, &PATTERNS[btype], sizeof(p));
+    uint8_t times = btype == btStart || btype == btDelay ? voice + 1 : 1,
+            len = times * (p.len + 1) - 1;
+
+    uint8_t h = q_head;
+    if (uint8_t((h - q_tail) & (BEEP_QUEUE - 1)) + len > BEEP_QUEUE - 1) {
+        dropped++;
+        return;
+    }
+
+    // the notes are in place before the head makes them visible to the interrupt
+    uint8_t n = 0;
+    for (uint8_t r = 0; r < times; r++) {
+        if (r > 0)
+            q[(h + n++) & (BEEP_QUEUE - 1)] = GAP | voice << 4;
+        for (uint8_t i = 0; i < p.len; i++)
+            q[(h + n++) & (BEEP_QUEUE - 1)] = (p.first + i) | voice << 4;
+    }
+    q_head = (h + len) & (BEEP_QUEUE - 1);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::Beeper::start_note(uint8_t entry)
+{
+    Note n;
+    memcpy_P(&n, &NOTES[entry & 0x0F], sizeof(n));
+    uint16_t freq = uint32_t(n.freq) * pgm_read_word(&PITCH[entry >> 4]) >> 8;
+
+    left_us += 1000L * n.dur;
+    release_us = 1000L * n.release;
+    env_top = n.freq != 0 ? uint16_t(n.level) << 8 : 0;
+    stage = esAttack;
+
+    // a rest keeps the engine running silently, so the next note starts in phase
+    if (n.freq != 0)
+        audio::play(freq, n.wave);
+    if (n.attack == 0) {
+        env = env_top;
+        env_step = 0;
+    }
+    else {
+        env = 0;
+        env_step = env_top / n.attack;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::Beeper::shape()
+{
+    // one envelope step per tick
+    switch (stage) {
+        case esAttack:
+            if (env_top - env > env_step)
+                env += env_step;
+            else {
+                env = env_top;
+                stage = esSustain;
+            }
+            break;
+
+        case esSustain:
+            if (left_us <= release_us) {
+                stage = esRelease;
+                env_step = release_us > 0 ? env / (release_us / hw::TICK_US + 1) : env;
+            }
+            break;
+
+        case esRelease:
+            env = env > env_step ? env - env_step : 0;
             break;
-   
-        case tsDelayed:
-            fStr += "DELAYED ";
-            sStr += dleft;
-            break; 
-  
-        case tsTPaused:
-            fStr += "T.PAUSED ";
-            sStr += tleft;
-            break; 
-  
-        case tsDPaused:
-            fStr += "D.PAUSED ";
-            sStr += dleft;
-            break; 
     }
-      
-    lcd.showLine(fStr, 0);
-    lcd.showLine(sStr, 1);
-    
+
+    audio::set_level(env >> 8);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::Beeper::on_tick(void *ctx)
+{
+    Beeper *b = static_cast<Beeper*>(ctx);
+
+    if (b->playing)
+        b->left_us -= hw::TICK_US;
+    else if (b->q_tail == b->q_head)
+        return;
+    else
+        b->left_us = 0;
+
+    // the overshoot of a note is taken from the next one, so the pattern
+    // keeps its length exactly
+    while (b->left_us <= 0) {
+        uint8_t t = b->q_tail;
+        if (t == b->q_head) {
+            audio::silence();
+            b->playing = false;
+            return;
+        }
+
+        b->start_note(b->q[t]);
+        b->playing = true;
+        b->q_tail = (t + 1) & (BEEP_QUEUE - 1);
+    }
+
+    b->shape();
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::RTimer::timer_run(keys::Key k) 
+{
+    Timer *t = &timers[sel];
+
     switch (k.code) {
         case keys::kcSelect:
             if (k.code == last_key_code)
-                return true;
-            ttime = get_ttime();
-            tleft = ttime;
-            trlim_left = trlimit;
-            last_millis = millis();
+                break;
+            // the intervals are all drawn before the session starts
+            if (!t->plan_valid || t->plan_used)
+                make_plan(*t);
+            t->plan_used = true;
             if (tstart_cntdwn) {
-                tstate = tsStartCntdwn;
-                start_cntdwn = START_CNTDWN;
+                set_state(sel, tsStartCntdwn);
+                t->phase.start(now(), 1000UL * START_CNTDWN);
             }
+            else if (start_phase(sel, now()))
+                t->limit.start(now(), 1000UL * t->trlimit);
             else
-                tstate = tsStarted;
+                break;
+            schedule_tick(*t, now());
             break;
   
         case keys::kcRight:
             if (k.code == last_key_code)
-                return true;
-            switch (tstate) {
+                break;
+            switch (t->tstate) {
                 case tsStarted:
-                    tstate = tsTPaused;
-                    break;
-                  
                 case tsDelayed:
-                    tstate = tsDPaused;
+                    set_state(sel, t->tstate == tsStarted ? tsTPaused : tsDPaused);
+                    t->phase.pause(now());
+                    t->limit.pause(now());
                     break;
                   
                 case tsTPaused:
-                    tstate = tsStarted;
-                    break;
-                  
                 case tsDPaused:
-                    tstate = tsDelayed;
+                    set_state(sel, t->tstate == tsTPaused ? tsStarted : tsDelayed);
+                    // the countdowns go on from the exact point they were paused at
+                    t->phase.resume(now());
+                    t->limit.resume(now());
+                    schedule_tick(*t, now());
                     break;
                   
                 default:
@@ -345,375 +1216,390 @@ bool rtimer::RTimer::timer_run(keys::Key k)
             }
             break;
   
+        // skips the phase or, on the stopped timer, previews the plan's next phase
         case keys::kcDown:
             if (k.code == last_key_code)
-                return true;
-            if (tstate == tsStarted) tleft = 0;
-            else if (tstate == tsDelayed) dleft = 0;
+                break;
+            if (t->tstate == tsStarted || t->tstate == tsDelayed) {
+                t->phase.start(now(), 0);
+                t->next_tick = now();
+            }
+            else if (t->tstate == tsNotStarted)
+                preview = preview + 1 < uint16_t(t->plan.get_drawn() - t->plan.get_first()) ? preview + 1 : 0;
+            break;
+
+        // the next timer, the others go on in the background
+        case keys::kcUp:
+            if (k.code == last_key_code)
+                break;
+            select_timer((sel + 1) % TIMERS);
+            t = &timers[sel];
             break;
 
         default:
             break;
     }
     last_key_code = k.code;
+    arm(sel);
+
+    if (t->tstate == tsNotStarted && !t->plan_valid)
+        make_plan(*t);
+
+    Line fStr,
+         sStr;
+    fStr.append_P(TIMERS > 1 ? S_TIMER_N : S_TIMER);
+    if (TIMERS > 1) {
+        fStr += uint32_t(sel + 1);
+        fStr += ":";
+    }
+    switch (t->tstate) {
+        case tsNotStarted: {
+            fStr.append_P(S_NOT_STARTED);
+            uint16_t i = t->plan.get_first() + preview;
+            Plan::Phase ph;
+            if (t->plan.peek(i, ph)) {
+                char kind[] = {char(pgm_read_byte(&S_KIND_LETTERS[ph.kind])), ':', 0};
+                sStr += "P";
+                sStr += uint32_t(i + 1);
+                sStr += " ";
+                sStr += kind;
+                sStr += uint32_t(ph.secs);
+            }
+            break;
+        }
   
-    // update time for timer or delay
-    if (millis() - last_millis >= 1000) {
-        switch (tstate) {
-            case tsStartCntdwn:
-                if (start_cntdwn > 1) {
-                    start_cntdwn--;
-                    beeper.beep(Beeper::btStartCntdwn);          
-                }
-                else {
-                    tstate = tsStarted;
-                    beeper.beep(Beeper::btStart);
-                }
-                break;
-          
-            case tsStarted:
-                if (tleft > 0) {
-                    tleft--;
-                    if (tend_cntdwn && tleft < STEP_CNTDWN)
-                        beeper.beep(Beeper::btEndCntdwn); 
-                }
-                else {
-                    tstate = tsDelayed;
-                    dtime = get_dtime();
-                    dleft = dtime;
-                    if (trmode == trmRounds)
-                        trlim_left--;
-                    beeper.beep(Beeper::btDelay);
-                }
-                if (trmode == trmTLimit)
-                    trlim_left--;
-                break;
-  
-            case tsDelayed:
-                if (dleft > 0) {
-                    dleft--;
-                    if (tstart_cntdwn && dleft < STEP_CNTDWN)
-                        beeper.beep(Beeper::btStartCntdwn);
-                }
-                else {
-                    tstate = tsStarted;
-                    ttime = get_ttime();
-                    tleft = ttime;
-                    beeper.beep(Beeper::btStart);
-                }
-                if (trmode == trmTLimit)
-                    trlim_left--;
-                break;
-          
-              default:
-                  break;
+        case tsStartCntdwn:
+            fStr.append_P(S_STARTS_IN);
+            sStr += t->phase.seconds(now());
+            break;
+        
+        case tsStarted:
+        case tsDelayed: {
+            const char *name;
+            memcpy_P(&name, &S_KINDS[t->kind], sizeof(name));
+            fStr.append_P(name);
+            sStr += t->phase.seconds(now());
+            break;
         }
-        last_millis = millis();
-    }
-    
-    // check for round limits
-    if (trmode != trmForever && trlim_left <= 0) {
-        if (tstate == tsStarted || tstate == tsDelayed)
-            beeper.beep(Beeper::btEnd);
-        tstate = tsNotStarted;
+  
+        case tsTPaused:
+            fStr.append_P(S_T_PAUSED);
+            sStr += t->phase.seconds(now());
+            break; 
+  
+        case tsDPaused:
+            fStr.append_P(S_D_PAUSED);
+            sStr += t->phase.seconds(now());
+            break; 
     }
       
+    lcd.showLine(fStr, 0);
+    lcd.showLine(sStr, 1);
+
     return true;
 }
 
 
 //------------------------------------------------------------------------------------------
-bool rtimer::RTimer::set_timer_run(keys::Key k) 
+unsigned long rtimer::RTimer::timer_engine()
 {
-    String fStr("SET TMR: "),
-           sStr("");
-    if (tmode == tmFixed) {
-        fStr += "FIX ";
-        sStr += tmin;
-        rtValue = rtvMin;
-    } else {
-        fStr += "RND ";
-        if (rtValue == rtvMin) {
-            sStr = "MIN: ";
-            sStr += tmin;
-        } else {
-            sStr = "MAX: ";
-            sStr += tmax;
-        }
+    // only the timers whose deadlines have come are looked at
+    uint8_t id;
+    bool shown = false;
+    while ((id = wheel.expired(now())) != TimerWheel::NONE) {
+        run_timer(id);
+        arm(id);
+        shown = shown || id == sel;
     }
-    lcd.showLine(fStr, 0);
-    lcd.showLine(sStr, 1);
-  
-    int delta = 0;
-    bool updated = false;
-  
-    switch (k.code) {
-        case keys::kcSelect:
-            if (k.code == last_key_code)
-                return true;
-            if (tmode == tmFixed)
-                tmode = tmRandom;
-            else {
-                tmode = tmFixed;
-                rtValue = rtvMin;
-            }
-            break;
-        
-        case keys::kcRight:
-            if (k.code == last_key_code)
-                return true;
-            if (tmode == tmRandom) {
-                if (rtValue == rtvMin)
-                    rtValue = rtvMax;
-                else
-                    rtValue = rtvMin;
-            }
-            else 
-                rtValue = rtvMin;          
+
+    // the page shows the new seconds
+    if (shown)
+        sched.wake(tUI, now());
+
+    return engine_deadline();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::run_timer(uint8_t id)
+{
+    Timer &tm = timers[id];
+
+    // Everything the timer does falls either on a whole second of the current
+    // phase (countdown beeps) or on its end. The events are processed at their
+    // own time, not at the time of the pass. A late pass catches up on all of
+    // them and the next phase starts exactly where the previous one ended,
+    // so the lateness never adds up
+    while (is_running(tm) && long(now() - tm.next_tick) >= 0) {
+        unsigned long t = tm.next_tick,
+                      late = now() - t;
+        tick_drift = late;
+        if (late > tick_drift_max)
+            tick_drift_max = late;
+
+        if (tm.trmode == trmTLimit && tm.tstate != tsStartCntdwn && tm.limit.expired(t)) {
+            beep(Beeper::btEnd, id);
+            set_state(id, tsNotStarted);
             break;
-        
-        case keys::kcUp:
-        case keys::kcDown:  
-            if (k.mode == keys::kmLong)
-                delta = -5;
-            else 
-                if (k.code != last_key_code)
-                    delta = -1;
-            if (k.code == keys::kcUp) // invert delta if UP pressed 
-                delta *= -1;
-            if (rtValue == rtvMin) {
-                tmin += delta;
-                tmin = normalize(tmin, TIMER_MIN_DEFAULT, TIMER_MAX_DEFAULT);
-                updated = true;
-            }
-            else {
-                tmax += delta;
-                tmax = normalize(tmax, TIMER_MIN_DEFAULT, TIMER_MAX_DEFAULT);
-                updated = true;
+        }
+
+        if (tm.phase.expired(t)) {
+            unsigned long end = tm.phase.get_end();
+            if (tm.tstate == tsStartCntdwn)
+                tm.limit.start(end, 1000UL * tm.trlimit);
+            // the program tells what comes next, its end ends the session
+            if (!start_phase(id, end)) {
+                beep(Beeper::btEnd, id);
+                break;
             }
-            // Align tmin and tmax according to timer mode
-            if ((tmode == tmRandom && tmin > tmax) || tmode == tmFixed)
-                tmax = tmin;
-            break;
+            beep(tm.tstate == tsStarted ? Beeper::btStart : Beeper::btDelay, id);
+        }
+        else {
+            uint32_t secs = tm.phase.seconds(t);
+            if (tm.tstate == tsStartCntdwn)
+                beep(Beeper::btStartCntdwn, id);
+            else if (tm.tstate == tsStarted && tend_cntdwn && secs <= STEP_CNTDWN)
+                beep(Beeper::btEndCntdwn, id);
+            else if (tm.tstate == tsDelayed && tstart_cntdwn && secs <= STEP_CNTDWN)
+                beep(Beeper::btStartCntdwn, id);
+        }
 
-        default:
-            break;
+        schedule_tick(tm, t);
     }
-    last_key_code = k.code;
-    //save config to EEPROM
-    if (updated)
-        save();
-  
-    return true;
 }
 
 
 //------------------------------------------------------------------------------------------
-bool rtimer::RTimer::set_delay_run(keys::Key k) 
+bool rtimer::RTimer::start_phase(uint8_t id, unsigned long at)
 {
-    String fStr("SET DELAY:"),
-           sStr("");
-    if (dmode == tmFixed) {
-        fStr += "FIX ";
-        sStr += dmin;
-        rtValue = rtvMin;
-    } else {
-        fStr += "RND ";
-        if (rtValue == rtvMin) {
-            sStr = "MIN: ";
-            sStr += dmin;
-        } else {
-            sStr = "MAX: ";
-            sStr += dmax;
-        }
+    Timer &tm = timers[id];
+    Plan::Phase ph;
+    if (!tm.plan.next(ph)) {
+        set_state(id, tsNotStarted);
+        return false;
     }
-    lcd.showLine(fStr, 0);
-    lcd.showLine(sStr, 1);
-  
-    int delta = 0;
-    bool updated = false;
-      
-    switch (k.code) {
-        case keys::kcSelect:
-            if (k.code == last_key_code)
-                return true;
-            if (dmode == tmFixed)
-                dmode = tmRandom;
-            else
-                dmode = tmFixed;
-            break;
-        
-        case keys::kcRight:
-            if (k.code == last_key_code)
-                return true;
-            if (dmode == tmRandom) {
-                if (rtValue == rtvMin)
-                    rtValue = rtvMax;
-                else
-                    rtValue = rtvMin;
-            }
-            else 
-                rtValue = rtvMin;          
-            break;
-        
-        case keys::kcUp:
-        case keys::kcDown:  
-            if (k.mode == keys::kmLong)
-                delta = -5;
-            else 
-                if (k.code != last_key_code)
-                    delta = -1;
-            if (k.code == keys::kcUp) // invert delta if UP pressed 
-                delta *= -1;
-            if (rtValue == rtvMin) {
-                dmin += delta;
-                dmin = normalize(dmin, DELAY_MIN_DEFAULT, DELAY_MAX_DEFAULT);
-                updated = true;
-            }
-            else {
-                dmax += delta;
-                dmax = normalize(dmax, DELAY_MIN_DEFAULT, DELAY_MAX_DEFAULT);
-                updated = true;
-            }
-            // Align tmin and tmax according to timer mode
-            if ((dmode == tmRandom && dmin > dmax) || dmode == tmFixed)
-                dmax = dmin;
-            break;
 
-        default:
-            break;
-    }
-    last_key_code = k.code;
-    //save config to EEPROM
-    if (updated)
-        save();
-  
+    // the phase tells the state as well
+    events.phase(id, ph.kind, ph.secs);
+    tm.kind = ph.kind;
+    tm.tstate = Program::is_work(ph.kind) ? tsStarted : tsDelayed;
+    tm.phase.start(at, 1000UL * ph.secs);
+    // the freed room is refilled after the transition's pass
+    sched.wake(tPlan, now() + 1);
+
     return true;
 }
 
 
 //------------------------------------------------------------------------------------------
-bool rtimer::RTimer::set_repeat_run(keys::Key k) 
+void rtimer::RTimer::set_state(uint8_t id, TimerState st)
 {
-    String fStr("SET RPT"),
-           sStr("");
+    Timer &tm = timers[id];
+    if (tm.tstate == st)
+        return;
 
-    switch (trmode) {
-        case trmForever:
-            fStr += ":FRV ";
-            break;
-            
-        case trmTLimit:
-            fStr += ":TIME ";
-            sStr += trlimit;
-            break;
-            
-        case trmRounds:
-            fStr += ":RND ";
-            sStr += trlimit;
-            break;
+    events.state(id, st);
+    tm.tstate = st;
+    if (st == tsNotStarted && log_autosave) {
+        log_pending = true;
+        sched.wake(tFlush, now());
     }
-    lcd.showLine(fStr, 0);
-    lcd.showLine(sStr, 1);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::arm(uint8_t id)
+{
+    if (is_running(timers[id]))
+        wheel.set(id, timers[id].next_tick);
+    else
+        wheel.cancel(id);
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::RTimer::engine_deadline()
+{
+    return wheel.next_deadline();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::RTimer::schedule_tick(Timer &tm, unsigned long t)
+{
+    tm.next_tick = tm.phase.next_second(t);
+
+    // the session time limit runs out in the middle of a phase
+    if (tm.trmode == trmTLimit && tm.tstate != tsStartCntdwn &&
+        long(tm.limit.get_end() - tm.next_tick) < 0)
+        tm.next_tick = tm.limit.get_end();
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::RTimer::edit_run(keys::Key k)
+{
+    Step st;
+    get_step(curr_step, st);
+    Editor ed;
+    memcpy_P(&ed, &EDITORS[st.editor], sizeof(Editor));
+
+    uint8_t mode = ed.mode != NULL && this->*ed.mode < ed.modes ? this->*ed.mode : 0;
+    if (edit_slot > 1 || ed.params[mode][edit_slot] == prNone)
+        edit_slot = 0;
+
+    Param p;
+    bool fresh = k.code != last_key_code,
+         updated = false;
 
-    int delta = 0;
-    bool updated = false;
-  
     switch (k.code) {
         case keys::kcSelect:
-            if (k.code == last_key_code)
-                return true;
-            if (trmode == trmRounds)       trmode = trmForever;
-            else if (trmode == trmForever) trmode = trmTLimit;
-            else if (trmode == trmTLimit)  trmode = trmRounds;
+            if (!fresh || ed.mode == NULL)
+                break;
+            mode = (mode + 1) % ed.modes;
+            this->*ed.mode = mode;
+            if (ed.params[mode][edit_slot] == prNone)
+                edit_slot = 0;
+            // the modes can share a setting of different ranges (trlimit)
+            for (uint8_t i = 0; i < 2; i++)
+                if (ed.params[mode][i] != prNone) {
+                    get_param(ed.params[mode][i], p);
+                    uint8_t &val = this->*p.value;
+                    val = val < p.lo ? p.lo : val > p.hi ? p.hi : val;
+                }
             updated = true;
             break;
-      
+
+        case keys::kcRight:
+            if (fresh)
+                edit_slot = edit_slot == 0 && ed.params[mode][1] != prNone ? 1 : 0;
+            break;
+
         case keys::kcUp:
-        case keys::kcDown:
-            if (trmode == trmForever)
-                break;  
-            if (k.mode == keys::kmLong)
-                delta = -5;
-            else 
-                if (k.code != last_key_code)
-                    delta = -1;
-            if (k.code == keys::kcUp) // invert delta if UP pressed 
-                delta *= -1;
-            trlimit += delta;
-            trlimit = normalize(trlimit, 
-                                trmode == trmTLimit ? 2 * TIMER_MIN_DEFAULT : 1,
-                                trmode == trmTLimit ? 2 * TIMER_MAX_DEFAULT : 50);
-            if (delta != 0)
+        case keys::kcDown: {
+            if (ed.params[mode][edit_slot] == prNone)
+                break;
+            get_param(ed.params[mode][edit_slot], p);
+            uint8_t &val = this->*p.value;
+
+            if (p.flag) {
+                if (fresh) {
+                    val = !val;
+                    updated = true;
+                }
+                break;
+            }
+
+            // a held key steps once per auto-repeat event of the keyboard,
+            // not on every pass the UI makes meanwhile
+            int16_t delta = k.mode == keys::kmLong ? (key_new ? p.repeat_step : 0) :
+                            fresh ? p.step : 0;
+            if (k.code == keys::kcDown)
+                delta = -delta;
+            // the sum is signed, so stepping down never wraps over to the top
+            int16_t v = int16_t(val) + delta;
+            v = v < p.lo ? p.lo : v > p.hi ? p.hi : v;
+            if (v != val) {
+                val = uint8_t(v);
                 updated = true;
+            }
             break;
+        }
 
         default:
             break;
     }
     last_key_code = k.code;
-    // save updated config to EEPROM
-    if (updated)
+
+    if (updated) {
+        if (ed.pair) {
+            get_param(ed.params[1][0], p);
+            uint8_t &lo = this->*p.value;
+            get_param(ed.params[1][1], p);
+            uint8_t &hi = this->*p.value;
+            if (mode == 0 || lo > hi)
+                hi = lo;
+        }
+        if (lcd_bklit != lcd.getBacklit())
+            lcd.changeBacklit(lcd_bklit);
         save();
+    }
 
-  return true;
+    Line fStr,
+         sStr;
+    fStr.append_P(ed.title);
+    if (ed.mode != NULL)
+        fStr.append_P(ed.mode_names[mode]);
+    if (ed.params[mode][edit_slot] != prNone) {
+        get_param(ed.params[mode][edit_slot], p);
+        sStr.append_P(p.label);
+        if (p.flag)
+            sStr.append_P(this->*p.value ? S_ON : S_OFF);
+        else
+            sStr += this->*p.value;
+    }
+    lcd.showLine(fStr, 0);
+    lcd.showLine(sStr, 1);
+
+    return true;
 }
 
 
 //------------------------------------------------------------------------------------------
-bool rtimer::RTimer::set_beep_run(keys::Key k) 
+bool rtimer::RTimer::set_keys_run(keys::Key k)
 {
-    String fStr("SET CNTDWN BEEP"),
-           sStr("");
+    // the page was just entered: the keys are learned from SELECT to RIGHT
+    if (cal_key == keys::kcNone && cal_result == crNone) {
+        cal_key = keys::kcSelect;
+        kbd.learn(cal_key);
+    }
+    else if (cal_key != keys::kcNone) {
+        // the keyboard reports the learned press as the key it learned
+        if (key_new && k.code == cal_key) {
+            if (cal_key != keys::kcRight) {
+                cal_key = keys::KeyCode(cal_key + 1);
+                kbd.learn(cal_key);
+            }
+            else {
+                cal_key = keys::kcNone;
+                cal_result = kbd.calibrate() ? crDone : crFailed;
+                if (cal_result == crDone) {
+                    // rarely written, so straight to the EEPROM
+                    uint16_t th[keys::LADDER_KEYS];
+                    uint8_t rec[ConfigStore::PAYLOAD_SIZE] = {};
+                    kbd.get_thresholds(th);
+                    for (uint8_t i = 0; i < keys::LADDER_KEYS; i++) {
+                        rec[2 * i] = uint8_t(th[i]);
+                        rec[2 * i + 1] = uint8_t(th[i] >> 8);
+                    }
+                    keys_store.save(rec);
+                }
+            }
+        }
+    }
+    else if (key_new && k.code != keys::kcNone) {
+        // any key leaves the result
+        cal_result = crNone;
+        last_key_code = k.code;
+        return false;
+    }
+    last_key_code = k.code;
 
-    if (rtValue == rtvMin) {
-        sStr += "START:";
-        if (tstart_cntdwn)
-            sStr += "ON";
-        else
-            sStr += "OFF";
+    Line fStr,
+         sStr;
+    if (cal_key != keys::kcNone) {
+        fStr.append_P(S_CALIBRATE);
+        char name[keys::KEY_NAME_SIZE];
+        sStr.append_P(S_PRESS);
+        sStr += keys::Keyboard::get_key_code_name(cal_key, name);
     }
     else {
-        sStr += "END:";
-        if (tend_cntdwn)
-            sStr += "ON";
-        else
-            sStr += "OFF";
+        fStr.append_P(cal_result == crDone ? S_CALIBRATED : S_CAL_FAIL);
+        sStr.append_P(S_PRESS_ANY);
     }
     lcd.showLine(fStr, 0);
     lcd.showLine(sStr, 1);
 
-    bool updated = false;
-    switch (k.code) {
-        case keys::kcRight:
-            if (k.code == last_key_code)
-                return true;
-            if (rtValue == rtvMin)
-                rtValue = rtvMax;
-            else
-                rtValue = rtvMin;
-            break;
-
-        case keys::kcUp:
-        case keys::kcDown:
-            if (k.code == last_key_code)
-                return true;
-            if (rtValue == rtvMin)
-                tstart_cntdwn = !tstart_cntdwn;
-            else
-                tend_cntdwn = !tend_cntdwn;      
-                
-            updated = true;
-            break;
-
-        default:
-            break;
-    }
-    last_key_code = k.code;
-    //save updated config to EEPROM
-    if (updated)
-        save();
-
     return true;
 }
 
@@ -721,8 +1607,10 @@ bool rtimer::RTimer::set_beep_run(keys::Key k)
 //------------------------------------------------------------------------------------------
 bool rtimer::RTimer::set_reset_run(keys::Key k) 
 {
-    String fStr("RESET?"),
-           sStr(reset_flag ? "YES" : "NO");
+    Line fStr,
+         sStr;
+    fStr.append_P(S_RESET);
+    sStr.append_P(reset_flag ? S_YES : S_NO);
     lcd.showLine(fStr, 0);
     lcd.showLine(sStr, 1);
   
@@ -751,37 +1639,5 @@ bool rtimer::RTimer::set_reset_run(keys::Key k)
 }
 
 
-//------------------------------------------------------------------------------------------
-bool rtimer::RTimer::set_bklit_run(keys::Key k) 
-{
-    String fStr("SET BACKLIT"),
-           sStr(lcd_bklit);
-    lcd.showLine(fStr, 0);
-    lcd.showLine(sStr, 1);
-  
-    if (k.code == last_key_code)
-        return true;
-    int delta = 0;
-    switch (k.code) {
-        case keys::kcUp:
-            delta = 5;
-            break;
-            
-        case keys::kcDown:
-            delta = -5;      
-            break;
-    }
-    last_key_code = k.code;
-    if (delta != 0) {
-      lcd_bklit += delta;
-      lcd_bklit = normalize(lcd_bklit, 5, 250);
-      lcd.changeBacklit(lcd_bklit);
-      save();
-    }
-  
-    return true;
-}
-
-
 //------------------------------------------------------------------------------------------
 
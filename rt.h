@@ -4,6 +4,15 @@
 #include <Arduino.h>
 #include <LiquidCrystal.h>
 #include <Keys.h>
+#include "rt_hw.h"
+#include "rt_sched.h"
+#include "rt_audio.h"
+#include "rt_store.h"
+#include "rt_rand.h"
+#include "rt_prog.h"
+#include "rt_plan.h"
+#include "rt_wheel.h"
+#include "rt_log.h"
 
 #define __RTIMER_DBG_
 
@@ -15,44 +24,287 @@ namespace rtimer {
     const uint8_t
         P_DISPLAY_BKLIT = 10,
         DISPLAY_BKLIT = 90,
+        LCD_COLS = 16,
+        LCD_QUEUE = 64,     // bytes waiting for the display, should be a power of 2
+        LATENCY_BUCKETS = 8,
+        BEEP_QUEUE = 16,    // notes waiting for the beeper, should be a power of 2
+        MENU_ITEMS = 7,     // the most options a menu step has
+        TIMERS = 2,         // timers running at once, UP on the timer page cycles them
+        PROGRAMS = 3,       // interval programs in the flash
+
+        // EEPROM of the ATmega328P: 50 slots of settings records, 8 ones for
+        // the saved event log, 4 ones for the settings of every timer after
+        // the first and the last 2 ones for the keyboard calibration
+        SETTINGS_FIRST = 0,
+        SETTINGS_SLOTS = 50,
+        LOG_FIRST = SETTINGS_FIRST + SETTINGS_SLOTS,
+        LOG_SLOTS = 8,
+        LOG_RECORD = 0x90,  // version byte of the event log records
+        TIMER_FIRST = LOG_FIRST + LOG_SLOTS,
+        TIMER_SLOTS = 4,
+        TIMER_RECORD = 0x82, // version byte of the second timer's records, +1 for the next ones
+        KEYS_FIRST = TIMER_FIRST + (TIMERS - 1) * TIMER_SLOTS,
+        KEYS_SLOTS = 2,
+        KEYS_RECORD = 0x81, // version byte of the calibration records
    
-        P_BEEPER = 3;
+        P_BEEPER = 3,
+        // analog pin the shield leaves open, its noise seeds the intervals
+        P_NOISE = 1;
     
     const uint16_t
         START_CNTDWN = 10,
         STEP_CNTDWN = 5,
        
         MIN_TOUT = 450,
+        SAVE_IDLE = 3000,   // ms without edits before the settings are written
         
         TIMER_MIN_DEFAULT = 30,
         TIMER_MAX_DEFAULT = 180,
         DELAY_MIN_DEFAULT = 1,
         DELAY_MAX_DEFAULT = 60;
 
+    // Fixed-size text of a single display line. Replaces String on the UI path,
+    // so building a line never touches the heap. Text beyond LCD_COLS is dropped
+    class Line {
+        public:
+            Line(const char *str = "") : len(0) { buf[0] = 0; *this += str; }
+
+            Line& operator += (const char *str) {
+                while (*str && len < LCD_COLS)
+                    buf[len++] = *str++;
+                buf[len] = 0;
+
+                return *this;
+            }
+
+            // The same for a text in the flash
+            Line& append_P(const char *str) {
+                char c;
+                while ((c = pgm_read_byte(str++)) != 0 && len < LCD_COLS)
+                    buf[len++] = c;
+                buf[len] = 0;
+
+                return *this;
+            }
+
+            Line& operator += (uint32_t num) {
+                char digits[10];
+                uint8_t n = 0;
+                do {
+                    digits[n++] = '0' + num % 10;
+                    num /= 10;
+                } while (num > 0);
+                while (n > 0 && len < LCD_COLS)
+                    buf[len++] = digits[--n];
+                buf[len] = 0;
+
+                return *this;
+            }
+
+            operator const char* () const { return buf; }
+
+        private:
+            char buf[LCD_COLS + 1];
+            uint8_t len;
+    };
+
+    // Millisecond countdown to an absolute deadline. A pause keeps the exact
+    // remainder, so pausing and resuming neither gains nor loses time
+    class Countdown {
+        public:
+            Countdown() : end(0), rest(0), running(false) {}
+
+            void start(unsigned long now, uint32_t ms) {
+                end = now + ms;
+                rest = ms;
+                running = true;
+            }
+
+            void pause(unsigned long now) {
+                if (running) {
+                    rest = left(now);
+                    running = false;
+                }
+            }
+
+            void resume(unsigned long now) {
+                if (!running) {
+                    end = now + rest;
+                    running = true;
+                }
+            }
+
+            uint32_t left(unsigned long now) const {
+                if (!running)
+                    return rest;
+
+                return long(end - now) > 0 ? end - now : 0;
+            }
+
+            bool expired(unsigned long now) const { return left(now) == 0; }
+
+            // Whole seconds left, rounded up as a countdown display shows them
+            uint32_t seconds(unsigned long now) const { return (left(now) + 999) / 1000; }
+
+            // The next moment after now the seconds() value drops, or the end
+            unsigned long next_second(unsigned long now) const {
+                uint32_t l = left(now);
+
+                return l == 0 ? end : end - (l - 1) / 1000 * 1000;
+            }
+
+            unsigned long get_end() const { return end; }
+
+        private:
+            unsigned long end;  // deadline while running
+            uint32_t rest;      // remainder while paused
+            bool running;
+    };
+
     class RTimer {
         public:
-          RTimer(const uint16_t lc_pins[6], const uint16_t keyboard_port, const uint8_t beep_port);
+          RTimer(const uint16_t lc_pins[6], const uint16_t keyboard_port, const uint8_t beep_port,
+                 keys::TimeSource time_src = millis);
+
+          // Seeds the random intervals from the ADC noise and starts the
+          // keyboard sampling. The sketch's setup() calls it: the ADC and
+          // Timer0 aren't set up yet when the global RTimer is constructed
+          void begin();
           
           void run();
+
+          // The earliest moment run() has something to do on its own: a timer tick,
+          // a beep to stop, a scroll step or a key timeout. Until then the timer
+          // only reacts on the keyboard. keys::NO_DEADLINE if nothing is scheduled
+          unsigned long next_deadline();
+
+          // Idle sleep until next_deadline() or a key event, but no longer than
+          // max_ms. The board's loop() calls it after run(), so the CPU only
+          // wakes up for the interrupts
+          void sleep(unsigned long max_ms = keys::NO_DEADLINE);
+
+          // Runtime counters for profiling
+          struct Stats {
+              uint32_t lcd_writes;    // characters sent to the display
+              uint32_t lcd_moves;     // cursor positioning commands
+              uint8_t lcd_queue_max;  // the deepest the display queue has been
+              uint32_t lcd_overflows; // cells postponed because the queue was full
+              uint16_t keys_lost;     // key events dropped by the full keyboard queue
+              uint16_t beeps_lost;    // beep patterns dropped by the full beeper queue
+              uint32_t cfg_writes;    // settings records written to the EEPROM
+              uint16_t cfg_dirty;     // settings bytes waiting to be written
+              // Time of the key handling on the settings pages. Bucket i counts
+              // the keys handled in less than 256 << i us, the last one the rest
+              uint16_t key_latency[LATENCY_BUCKETS];
+              uint32_t tick_drift;    // how late the last timer second was counted, ms
+              uint32_t tick_drift_max;
+              uint32_t awake_ms;      // time since power on spent out of sleep()
+              uint32_t asleep_ms;     // time spent in sleep()
+          };
+
+          Stats get_stats();
+
+          // Run counts and execution times of the main loop tasks
+          const Scheduler& get_scheduler() { return sched; };
+
+          // Restarts the seeds of the session plans from a known one, e.g. to
+          // replay a session. The next session of every timer gets a new plan
+          void seed_random(uint32_t seed) {
+              rng.seed(seed);
+              for (uint8_t i = 0; i < TIMERS; i++)
+                  timers[i].plan_valid = false;
+          };
+
+          // Intervals of the selected timer's session being run or, while the
+          // timer is stopped, of its next (or the last) one. The timer page
+          // previews them by DOWN before the start
+          const Plan& get_plan() { return timers[sel].plan; };
+          void dump_plan(Print &out) { timers[sel].plan.dump(out); };
+
+          // The timer the timer page shows and the settings pages edit
+          uint8_t get_selected() { return sel; };
+
+          // What the sessions did: the key events, the timers' states, their
+          // phases with the drawn lengths and the beeps. dump_log() writes
+          // the log in RAM, dump_saved_log() the events saved to the EEPROM.
+          // save_log() saves the events logged since the last save, with the
+          // autosave on (off by default) the flush task does it after every
+          // session
+          const EventLog& get_log() { return events; };
+          void dump_log(Print &out) { events.dump(out); };
+          void dump_saved_log(Print &out) { events.dump_saved(out); };
+          bool save_log() { return events.save(); };
+          void set_log_autosave(bool on) { log_autosave = on; };
+
+          // Edited settings are written after ms without further edits
+          // or when the settings page is left
+          void set_save_idle(uint16_t ms) { save_idle = ms; };
           
         private:
-            // Liquid display controller
+            // Liquid display controller.
+            // After the initialization LC doesn't wait for the display. The bytes
+            // are queued and the tick interrupt clocks them out one per tick
             class LC {
                 public:
-                    LC(const uint16_t lc_pins[6]);
-                    void showLine(String str, uint8_t line);
+                    LC(const uint16_t lc_pins[6], keys::TimeSource time_src);
+                    ~LC();
+                    // Lines longer than LCD_COLS are scrolled straight from str,
+                    // so such a text should outlive the call (a step description)
+                    void showLine(const char *str, uint8_t line) { show(str, line, false); };
+                    // The same for a text in the flash
+                    void showLine_P(const char *str, uint8_t line) { show(str, line, true); };
+                    // Moves the long lines one character on when it's time
+                    void scrollLines();
                     void changeBacklit(uint8_t new_bl);
                     uint8_t getBacklit() { return bklit; };
+                    unsigned long next_deadline();
+                    uint32_t getWrites() { return writes; };
+                    uint32_t getMoves() { return moves; };
+                    uint8_t getQueueMax() { return q_max; };
+                    uint32_t getOverflows() { return overflows; };
                     
                 private:
                     LiquidCrystal _lcd;
+                    keys::TimeSource now;
                     uint64_t display_tout;
-                    String lines[2];
+                    const char *scroll[2];       // long lines being scrolled or NULL
+                    bool scroll_P[2];            // the scrolled text is in the flash
+                    uint8_t scroll_len[2];
                     uint64_t last_disp_time;
                     byte pos[2];
                     uint8_t bklit;
+
+                    // Shadow copy of the display. Only cells which differ from it
+                    // are sent to the controller
+                    char fb[2][LCD_COLS];
+                    uint8_t cur_col;
+                    uint8_t cur_row;
+                    uint32_t writes;
+                    uint32_t moves;
+
+                    // Display bus: rs, en, d4, d5, d6, d7
+                    uint8_t pins[6];
+                    // Ring of bytes for the controller. The main loop moves the head,
+                    // the tick interrupt moves the tail. Bits of q_rs flag data bytes
+                    uint8_t q_data[LCD_QUEUE];
+                    uint8_t q_rs[LCD_QUEUE / 8];
+                    volatile uint8_t q_head;
+                    volatile uint8_t q_tail;
+                    uint8_t q_max;
+                    uint32_t overflows;
+
+                    void show(const char *str, uint8_t line, bool flash);
+                    void draw(const char *str, uint8_t line, bool flash = false);
+                    uint8_t queued() { return (q_head - q_tail) & (LCD_QUEUE - 1); };
+                    void enqueue(uint8_t value, bool data);
+                    void send(uint8_t value, bool data);
+                    static void on_tick(void *ctx);
             };
 
+            // Beep sequencer. A beep is a pattern of notes and rests. The patterns
+            // are queued and the tick interrupt plays them note by note through
+            // the audio engine, shaping every note with its envelope. So the beeps
+            // never cut each other off and their lengths don't depend on the main loop
             class Beeper {
                 public:
                     // Beep type
@@ -65,19 +317,68 @@ namespace rtimer {
                             btEnd
                         } TBeepType;
                         
+                    // Single note of a pattern, a rest if freq is 0. The envelope
+                    // rises to level in attack ms and falls to silence in the
+                    // last release ms of the note
+                    struct Note {
+                        uint16_t freq;
+                        uint16_t dur;       // ms
+                        audio::Wave wave;
+                        uint8_t level;
+                        uint8_t attack;
+                        uint8_t release;
+                    };
+
                     Beeper(uint8_t bport);
-                    void beep(TBeepType btype);
-                    void check_beeper();
+                    ~Beeper();
+                    // Queues the beep's pattern in the voice of a timer. A
+                    // voice plays a minor third (1) or a fourth (2) higher and
+                    // repeats the phase beeps voice + 1 times, so the timers
+                    // can be told apart. A pattern which doesn't fit into the
+                    // queue is dropped as a whole
+                    void beep(TBeepType btype, uint8_t voice = 0);
+                    uint16_t getDropped() { return dropped; };
                  
                 private:
                     uint8_t beeper_port;
-                    uint64_t stop_beep_millis; // to prevent using delay(), each beep() call
-                                               // sets a new time to call noTone() to stop beep
-                    // Single beep info
-                    struct Beep {
-                            uint32_t freq;
-                            uint64_t dur;
-                        } beeps[5];                     
+
+                    // Notes of all the patterns, a pattern is a run of them.
+                    // The tables are in the flash
+                    struct Pattern {
+                        uint8_t first;
+                        uint8_t len;
+                    };
+                    static const Note NOTES[];
+                    static const Pattern PATTERNS[];    // of every TBeepType
+                    static const uint8_t GAP;       // the rest between repeats
+                    static const uint16_t PITCH[];  // of every voice, 8.8 fixed point
+
+                    // Indexes of the notes to play, the voice in the high
+                    // nibble. The main loop moves the head, the tick interrupt the tail
+                    uint8_t q[BEEP_QUEUE];
+                    volatile uint8_t q_head;
+                    volatile uint8_t q_tail;
+                    uint16_t dropped;
+
+                    // interrupt side: the note being played, its time left and envelope
+                    typedef
+                        enum {
+                            esAttack,
+                            esSustain,
+                            esRelease
+                        } EnvStage;
+
+                    bool playing;
+                    int32_t left_us;
+                    int32_t release_us;
+                    uint16_t env;       // 8.8 fixed point level
+                    uint16_t env_top;
+                    uint16_t env_step;
+                    EnvStage stage;
+
+                    void start_note(uint8_t entry);
+                    void shape();
+                    static void on_tick(void *ctx);
             };
             
             // Single step of timer IDs
@@ -92,44 +393,107 @@ namespace rtimer {
                     pBeepSet,
                     pReSet,
                     pBklitSet,
+                    pKeysSet,
+                    stCount
                 } StepID;
 
             // callback function type to process menuItem call
             typedef bool (RTimer::*RunProc)(keys::Key k);
       
-            // Single step of the timer data
+            // Single step of the timer data. The steps live in the flash,
+            // so do the texts name and descr point to
             typedef 
                 struct {
-                    StepID id;
-                    String name;
-                    String descr;
+                    const char *name;
+                    const char *descr;
                     StepID prev;
-                    StepID next[6];  
+                    StepID next[MENU_ITEMS];
                     RunProc runner; // callback proc to proceess the step
                                     // if NULL, then it's just a menu item with
                                     // no defined processor
+                    uint8_t editor; // EDITORS entry of an edit_run() step
                 } Step;
 
-            // Interval type for timer of for delay
-            typedef 
+            // Editable settings, indexes of PARAMS
+            typedef
                 enum {
-                    tmFixed,
-                    tmRandom
-                } TimerMode;
+                    prTimerFix,
+                    prTimerMin,
+                    prTimerMax,
+                    prDelayFix,
+                    prDelayMin,
+                    prDelayMax,
+                    prTimeLimit,
+                    prRounds,
+                    prProgram,
+                    prStartBeep,
+                    prEndBeep,
+                    prBacklit,
+                    prCount,
+                    prNone = 0xFF
+                } ParamID;
+
+            // Single editable setting. UP/DOWN step the value by step on a press
+            // and by repeat_step on every auto-repeat of a held key. A flag is
+            // an ON/OFF switch which UP/DOWN toggle
+            typedef
+                struct {
+                    const char *label;          // flash text before the value
+                    uint8_t RTimer::*value;
+                    uint8_t lo;
+                    uint8_t hi;
+                    uint8_t step;
+                    uint8_t repeat_step;        // 0 if a held key doesn't repeat
+                    bool flag;
+                } Param;
+
+            // Settings pages, indexes of EDITORS
+            typedef
+                enum {
+                    edTimer,
+                    edDelay,
+                    edRepeat,
+                    edBeep,
+                    edBacklit,
+                    edCount,
+                    edNone = 0xFF
+                } EditorID;
 
-            // Minimal or maximal part of random value to edit 
+            // Settings page of edit_run(). SELECT cycles the page's mode,
+            // RIGHT moves between the params of the mode, UP/DOWN change
+            // the selected one
+            typedef
+                struct {
+                    const char *title;          // flash
+                    uint8_t RTimer::*mode;      // NULL if the page has no modes
+                    uint8_t modes;
+                    const char *mode_names[4];  // flash, shown after the title
+                    uint8_t params[4][2];       // ParamID of every mode or prNone
+                    // The params of mode 1 are a min/max pair: max never gets
+                    // below min and follows it in mode 0 (fixed)
+                    bool pair;
+                } Editor;
+
+            // Interval type for timer of for delay. The random ones are drawn
+            // from min to max by the distributions of Random in their order,
+            // the same as Program::Mode
             typedef 
                 enum {
-                    rtvMin,
-                    rtvMax
-                } RndTimerValue;
+                    tmFixed,
+                    tmRandom,
+                    tmNormal,
+                    tmExp
+                } TimerMode;
 
-            // Timer repeating mode
+            // Timer repeating mode. In trmProgram the session is the
+            // program trlimit of the flash instead of the rounds of the
+            // timer and the delay settings
             typedef 
                 enum {
                     trmForever,
                     trmTLimit,
-                    trmRounds
+                    trmRounds,
+                    trmProgram
                 } TimerRepeatMode;
 
             // Timer states
@@ -143,97 +507,206 @@ namespace rtimer {
                     tsDPaused
                 } TimerState; 
 
+            // A timer of its own: its settings, session and plan. The settings
+            // pages edit the selected timer through the RTimer members of the
+            // same names
+            struct Timer {
+                uint8_t tmode;
+                uint8_t tmin;
+                uint8_t tmax;
+                uint8_t dmode;
+                uint8_t dmin;
+                uint8_t dmax;
+                uint8_t trmode;
+                uint8_t trlimit;
+
+                TimerState tstate;
+                unsigned long next_tick;    // when the timer has the next thing to do
+                uint8_t kind;       // Program::Kind of the phase in progress
+                Countdown phase;    // start countdown, timer or delay in progress
+                Countdown limit;    // session time left in trmTLimit mode
+
+                // The session's program, compiled from the settings or copied
+                // from the flash, and its intervals drawn before it starts.
+                // The plan is valid while it matches the settings and used
+                // once it's started
+                Program prog;
+                Plan plan;
+                bool plan_valid;
+                bool plan_used;
+            };
+
             //------------------------------------------------------------
             // RTimer variables
             //------------------------------------------------------------
+            keys::TimeSource now;
             keys::Keyboard kbd;
             LC lcd;
+            EventLog events;
+            bool log_autosave;
+            bool log_pending;   // a session is over, the flush task saves the log
+
+            // Main loop tasks. Each one runs only when it's due or woken up
+            // by another task
+            typedef
+                enum {
+                    tKeys,      // takes key events from the keyboard queue
+                    tScroll,    // scrolls the long lines
+                    tEngine,    // counts the timer seconds and phases
+                    tUI,        // feeds the keys to the steps and draws them
+                    tFlush,     // writes the edited settings to the EEPROM
+                    tPlan       // draws the phases of a long session ahead of the engine
+                } TaskID;
+
+            Scheduler sched;
 
-            // Timer core variables
-            TimerState tstate;
-            uint64_t last_millis;
-            TimerMode tmode;  // timer mode
+            static unsigned long keys_task(void *ctx, unsigned long t);
+            static unsigned long scroll_task(void *ctx, unsigned long t);
+            static unsigned long engine_task(void *ctx, unsigned long t);
+            static unsigned long ui_task(void *ctx, unsigned long t);
+            static unsigned long flush_task(void *ctx, unsigned long t);
+            static unsigned long plan_task(void *ctx, unsigned long t);
+
+            // Timer core variables. The engine runs the timers whose deadlines
+            // the wheel gives out, an entry per timer
+            Timer timers[TIMERS];
+            uint8_t sel;                    // the timer of the timer page
+            TimerWheel wheel;
+            unsigned long tick_drift;       // how late the last second was counted, ms
+            unsigned long tick_drift_max;
+
+            // Duty cycle
+            unsigned long power_on;
+            uint32_t asleep_ms;
+            uint32_t asleep_us;     // sub-millisecond remainder of asleep_ms
+            // The settings are bytes, so that the editor tables can point to them.
+            // The ones of a timer are the selected timer's
+            uint8_t tmode;    // timer mode, TimerMode
             uint8_t tmin;
             uint8_t tmax;
-            TimerMode dmode; // delay mode
+            uint8_t dmode;   // delay mode, TimerMode
             uint8_t dmin;
             uint8_t dmax;
-            TimerRepeatMode trmode;
+            uint8_t trmode;  // TimerRepeatMode
             uint8_t  trlimit;
-            uint8_t  trlim_left;
-            RndTimerValue rtValue;
-            uint8_t ttime;
-            uint8_t tleft;
-            uint8_t dtime;
-            uint8_t dleft;
+            uint8_t edit_slot;  // the param of the settings page being edited
+            uint8_t preview;    // the phase the stopped timer page shows
 
             bool reset_flag;
 
-            // States map of the timer
-            Step steps[9];
+            // Settings in the EEPROM. The members above are their write-back
+            // cache: save() only marks the changed bytes dirty and the flush
+            // task commits them once the editing is over
+            ConfigStore store;
+            ConfigStore keys_store; // keyboard thresholds, LE words in ladder order
+            // Settings of the timers after the first. Their payload is the
+            // first 8 bytes of the settings one
+            ConfigStore timer_stores[TIMERS - 1];
+            uint16_t cfg_dirty;
+            uint8_t timers_dirty;   // bit i: timer i has settings to write
+            unsigned long flush_at;
+            uint16_t save_idle;
+
+            bool key_new;       // curr_key is an event the steps haven't seen yet
+            bool key_timed;     // the pass handles a key on a settings page
+            uint16_t key_latency[LATENCY_BUCKETS];
+
+            // States map of the timer, indexed by StepID
+            static const Step STEPS[stCount];
+            // Settings editor tables
+            static const Param PARAMS[prCount];
+            static const Editor EDITORS[edCount];
             // Timer steps' managing variables
             StepID curr_step;
             int curr_menu_item;
             uint8_t last_key_code;
+            keys::Key curr_key; // keyboard state after the last key event
 
             // Timer's beeper control
             Beeper beeper;
+            Random rng;     // seeds of the session plans
             // flags to enable/disable countdown beeps
             // Starts countdown could only be disabled for 
             // session after delay. Initial countdown is always presented
-            bool tstart_cntdwn;
-            bool tend_cntdwn;
-            // beeps managing variables
-            uint8_t start_cntdwn;
+            uint8_t tstart_cntdwn;
+            uint8_t tend_cntdwn;
 
             // backlit value
             uint8_t lcd_bklit;
 
+            // keyboard calibration page: the key being learned, then the result
+            typedef
+                enum {
+                    crNone,
+                    crDone,
+                    crFailed
+                } CalResult;
+
+            keys::KeyCode cal_key;
+            CalResult cal_result;
+
             // Timer step processing routines
             bool timer_run(keys::Key k);
-            bool set_timer_run(keys::Key k);
-            bool set_delay_run(keys::Key k);
-            bool set_repeat_run(keys::Key k);
-            bool set_beep_run(keys::Key k);
+            // Runs every settings page described by EDITORS
+            bool edit_run(keys::Key k);
             bool set_reset_run(keys::Key k);
-            bool set_bklit_run(keys::Key k);
-            
-            uint16_t normalize(uint16_t val, uint16_t minv, uint16_t maxv) {
-                if (val < minv)
-                    return minv;
-                if (val > maxv)
-                    return maxv;
-          
-                return val;
+            bool set_keys_run(keys::Key k);
+
+            // Draws the intervals of the timer's next session from a new seed
+            void make_plan(Timer &t);
+            // Compiles the rounds of the timer's settings into its program
+            static void compile(Timer &t);
+            // Starts the timer's next phase of the plan at the time.
+            // false at the end of the session
+            bool start_phase(uint8_t id, unsigned long at);
+
+            static bool is_running(const Timer &t) {
+                return t.tstate == tsStartCntdwn || t.tstate == tsStarted || t.tstate == tsDelayed;
             }
 
-            uint16_t get_ttime() {
-                if (tmode == tmFixed)
-                    return tmin;
-              
-                return random(tmin, tmax);
+            void schedule_tick(Timer &t, unsigned long at);
+            // Changes the timer's state and logs it. The end of a session
+            // has the log saved in the autosave mode
+            void set_state(uint8_t id, TimerState st);
+            void beep(Beeper::TBeepType btype, uint8_t id) {
+                events.beep(btype, id);
+                beeper.beep(btype, id);
             }
-      
-            uint16_t get_dtime() {
-                if (dmode == tmFixed)
-                    return dmin;
-              
-                return random(dmin, dmax);
-            }      
-
-            Step *get_step(StepID id) {
-                Step *step = NULL;
-                for (uint16_t i = 0; i < 9; i++)
-                    if (steps[i].id == id) {
-                        step = &(steps[i]);
-                        break;
-                    }
-                return step;
+            // Puts the timer's next tick on the wheel or takes it off
+            void arm(uint8_t id);
+            // Counts the timer's seconds and phases up to now
+            void run_timer(uint8_t id);
+            unsigned long timer_engine();
+            unsigned long engine_deadline();
+
+            // Moves the settings members to the timer and back
+            void to_timer(Timer &t);
+            void from_timer(const Timer &t);
+            void select_timer(uint8_t id);
+
+            // Processes the key on the current step
+            void step(keys::Key key);
+            // Draws the current step without feeding it a key
+            void show();
+
+            void get_step(StepID id, Step &step) {
+                memcpy_P(&step, &STEPS[id], sizeof(Step));
+            }
+
+            void get_param(uint8_t id, Param &param) {
+                memcpy_P(&param, &PARAMS[id], sizeof(Param));
             }
             
             void set_defaults();
             void load();
+            void pack(uint8_t cfg[ConfigStore::PAYLOAD_SIZE]);
+            static void pack_timer(const Timer &t, uint8_t cfg[ConfigStore::PAYLOAD_SIZE]);
+            static void unpack_timer(const uint8_t cfg[ConfigStore::PAYLOAD_SIZE], Timer &t);
             void save();
+            void commit();
+            bool is_dirty() { return cfg_dirty != 0 || timers_dirty != 0; };
+            void load_keys();
+            bool is_settings(StepID id) { return id >= pTimerSet && id <= pKeysSet; };
             void reset();
     };
 }; // end of rtimer namespace
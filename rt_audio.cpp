@@ -0,0 +1,160 @@
+#include "rt_audio.h"
+
+#if defined(__AVR__)
+    #include <avr/interrupt.h>
+#elif defined(RTIMER_HOST)
+    #include "hal.h"
+#endif
+
+
+namespace {
+
+    // One period of a sine, 256 signed samples
+    const int8_t SINE[256] PROGMEM = {
+           0,    3,    6,    9,   12,   16,   19,   22,   25,   28,   31,   34,   37,   40,   43,   46,
+          49,   51,   54,   57,   60,   63,   65,   68,   71,   73,   76,   78,   81,   83,   85,   88,
+          90,   92,   94,   96,   98,  100,  102,  104,  106,  107,  109,  111,  112,  113,  115,  116,
+         117,  118,  120,  121,  122,  122,  123,  124,  125,  125,  126,  126,  126,  127,  127,  127,
+         127,  127,  127,  127,  126,  126,  126,  125,  125,  124,  123,  122,  122,  121,  120,  118,
+         117,  116,  115,  113,  112,  111,  109,  107,  106,  104,  102,  100,   98,   96,   94,   92,
+          90,   88,   85,   83,   81,   78,   76,   73,   71,   68,   65,   63,   60,   57,   54,   51,
+          49,   46,   43,   40,   37,   34,   31,   28,   25,   22,   19,   16,   12,    9,    6,    3,
+           0,   -3,   -6,   -9,  -12,  -16,  -19,  -22,  -25,  -28,  -31,  -34,  -37,  -40,  -43,  -46,
+         -49,  -51,  -54,  -57,  -60,  -63,  -65,  -68,  -71,  -73,  -76,  -78,  -81,  -83,  -85,  -88,
+         -90,  -92,  -94,  -96,  -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+        -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+        -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+        -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100,  -98,  -96,  -94,  -92,
+         -90,  -88,  -85,  -83,  -81,  -78,  -76,  -73,  -71,  -68,  -65,  -63,  -60,  -57,  -54,  -51,
+         -49,  -46,  -43,  -40,  -37,  -34,  -31,  -28,  -25,  -22,  -19,  -16,  -12,   -9,   -6,   -3,
+    };
+
+    uint8_t out_pin = 0xFF;
+
+    // synthesizer state, written by the tick interrupt and read by the sample one
+    volatile uint16_t phase_inc = 0;
+    volatile uint8_t level = 0;
+    volatile rtimer::audio::Wave wave = rtimer::audio::wSine;
+    uint16_t phase = 0;
+    bool on = false;
+
+#if defined(RTIMER_HOST)
+    void host_sample_isr()
+    {
+        hal::audio_sample(out_pin, rtimer::audio::next_sample());
+    }
+#endif
+
+    void start_output()
+    {
+#if defined(__AVR__)
+        // phase correct 8-bit PWM without a prescaler on OC2B
+        TCCR2A = _BV(COM2B1) | _BV(WGM20);
+        TCCR2B = _BV(CS20);
+        OCR2B = 0x80;
+        TIFR2 = _BV(TOV2);
+        TIMSK2 = _BV(TOIE2);
+#elif defined(RTIMER_HOST)
+        hal::attach_isr(host_sample_isr, rtimer::audio::SAMPLE_US);
+#endif
+    }
+
+    void stop_output()
+    {
+#if defined(__AVR__)
+        TIMSK2 = 0;
+        TCCR2A = 0;
+        TCCR2B = 0;
+#elif defined(RTIMER_HOST)
+        hal::detach_isr(host_sample_isr);
+#endif
+        digitalWrite(out_pin, LOW);
+    }
+}
+
+
+#if defined(__AVR__)
+ISR(TIMER2_OVF_vect)
+{
+    // the PWM overflows at 31.25 kHz, every second period gets a new sample
+    static bool skip = false;
+
+    skip = !skip;
+    if (skip)
+        return;
+
+    OCR2B = rtimer::audio::next_sample();
+}
+#endif
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::audio::begin(uint8_t pin)
+{
+    out_pin = pin;
+    pinMode(out_pin, OUTPUT);
+    digitalWrite(out_pin, LOW);
+    silence();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::audio::end()
+{
+    silence();
+    out_pin = 0xFF;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::audio::play(uint16_t freq, Wave w)
+{
+    phase_inc = (uint32_t(freq) << 16) / SAMPLE_RATE;
+    wave = w;
+#if defined(RTIMER_HOST)
+    hal::audio_note(out_pin, freq);
+#endif
+
+    if (!on) {
+        on = true;
+        phase = 0;
+        start_output();
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::audio::set_level(uint8_t l)
+{
+    level = l;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::audio::silence()
+{
+    level = 0;
+    if (!on)
+        return;
+
+    on = false;
+    stop_output();
+#if defined(RTIMER_HOST)
+    hal::audio_note(out_pin, 0);
+#endif
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::audio::next_sample()
+{
+    phase += phase_inc;
+
+    int8_t s;
+    if (wave == wSine)
+        s = int8_t(pgm_read_byte(&SINE[phase >> 8]));
+    else
+        s = phase & 0x8000 ? -127 : 127;
+
+    return uint8_t(0x80 + ((int16_t(s) * level) >> 8));
+}
@@ -0,0 +1,40 @@
+#ifndef __RT_AUDIO_H_
+#define __RT_AUDIO_H_
+
+#include <Arduino.h>
+
+namespace rtimer {
+    // Waveform audio engine. The beeper pin is driven by a 31.25 kHz PWM and
+    // every second PWM period its duty is set to the next sample of a phase
+    // accumulator synthesizer. A sample always costs one table lookup and one
+    // multiplication, so the sample interrupt is short and the keyboard ADC
+    // interrupt waits for it a few microseconds at most.
+    // On a 16 MHz board the pin has to be 3 (OC2B), the engine takes Timer2 over,
+    // so tone() shouldn't be used along with it
+    namespace audio {
+        const uint16_t SAMPLE_RATE = 15625;
+        const uint16_t SAMPLE_US = 64;
+
+        typedef
+            enum {
+                wSine,
+                wSquare
+            } Wave;
+
+        void begin(uint8_t pin);
+        void end();
+
+        // Starts a tone or changes the current one. The phase goes on,
+        // so changing a tone doesn't click
+        void play(uint16_t freq, Wave wave);
+        // Volume of the tone, 0 is silence
+        void set_level(uint8_t level);
+        // Stops the tone and the sample interrupt
+        void silence();
+
+        // The next PWM duty value. Used by the sample interrupt
+        uint8_t next_sample();
+    }
+}; // end of rtimer namespace
+
+#endif // __RT_AUDIO_H_
@@ -0,0 +1,112 @@
+#include "rt_hw.h"
+
+#if defined(__AVR__)
+    #include <avr/interrupt.h>
+    #include <avr/sleep.h>
+#elif defined(RTIMER_HOST)
+    #include "hal.h"
+#endif
+
+
+namespace {
+
+    struct TickSlot {
+        rtimer::hw::TickHandler handler;
+        void *ctx;
+    };
+
+    TickSlot tick_slots[rtimer::hw::MAX_TICK_HANDLERS];
+    volatile uint8_t tick_count = 0;
+
+    void start_tick()
+    {
+#if defined(__AVR__)
+        // compare B fires in the middle of the Timer0 period, the output pin stays disconnected
+        OCR0B = 0x80;
+        TIFR0 = _BV(OCF0B);
+        TIMSK0 |= _BV(OCIE0B);
+#elif defined(RTIMER_HOST)
+        hal::attach_isr(rtimer::hw::tick, rtimer::hw::TICK_US);
+#endif
+    }
+
+    void stop_tick()
+    {
+#if defined(__AVR__)
+        TIMSK0 &= ~_BV(OCIE0B);
+#elif defined(RTIMER_HOST)
+        hal::detach_isr(rtimer::hw::tick);
+#endif
+    }
+}
+
+
+#if defined(__AVR__)
+ISR(TIMER0_COMPB_vect)
+{
+    rtimer::hw::tick();
+}
+#endif
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::hw::add_tick(TickHandler handler, void *ctx)
+{
+    if (tick_count >= MAX_TICK_HANDLERS)
+        return false;
+
+    // the slot is filled before it becomes visible to the interrupt
+    tick_slots[tick_count].handler = handler;
+    tick_slots[tick_count].ctx = ctx;
+    tick_count++;
+
+    if (tick_count == 1)
+        start_tick();
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::hw::remove_tick(TickHandler handler, void *ctx)
+{
+    noInterrupts();
+    for (uint8_t i = 0; i < tick_count; i++)
+        if (tick_slots[i].handler == handler && tick_slots[i].ctx == ctx) {
+            for (uint8_t j = i + 1; j < tick_count; j++)
+                tick_slots[j - 1] = tick_slots[j];
+            tick_count--;
+            break;
+        }
+    interrupts();
+
+    if (tick_count == 0)
+        stop_tick();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::hw::tick()
+{
+    for (uint8_t i = 0; i < tick_count; i++)
+        tick_slots[i].handler(tick_slots[i].ctx);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::hw::idle()
+{
+#if defined(__AVR__)
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    // the instruction after sei is executed before any interrupt,
+    // so there is no gap between the check and the sleep
+    sei();
+    sleep_cpu();
+    sleep_disable();
+#elif defined(RTIMER_HOST)
+    hal::wait_for_interrupt();
+#else
+    interrupts();
+#endif
+}
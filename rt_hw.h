@@ -0,0 +1,37 @@
+#ifndef __RT_HW_H_
+#define __RT_HW_H_
+
+#include <Arduino.h>
+
+namespace rtimer {
+    // Hardware services shared by the timer's components
+    namespace hw {
+        // System tick. On a 16 MHz board it's the Timer0 compare B interrupt,
+        // which fires once per Timer0 overflow and leaves millis() untouched
+        const uint16_t TICK_US = 1024;
+
+        const uint8_t MAX_TICK_HANDLERS = 4;
+
+        // Tick handler runs in the interrupt context, so it should be short
+        // and share data with the main loop only through volatile variables
+        typedef void (*TickHandler)(void *ctx);
+
+        // Add a handler to the tick. The tick starts with the first handler
+        // and stops when the last one is removed. Returns false if there is
+        // no free slot left
+        bool add_tick(TickHandler handler, void *ctx);
+        void remove_tick(TickHandler handler, void *ctx);
+
+        // Calls all the tick handlers. Used by the interrupt
+        void tick();
+
+        // Puts the MCU into the idle sleep until the next interrupt. It's called
+        // with interrupts disabled and enables them, so an interrupt coming
+        // after the caller's last check still wakes it up.
+        // Deeper modes would stop Timer0 and with it millis(), the system tick
+        // and the keyboard sampling
+        void idle();
+    }
+}; // end of rtimer namespace
+
+#endif // __RT_HW_H_
@@ -0,0 +1,234 @@
+#include "rt_log.h"
+
+
+//------------------------------------------------------------------------------------------
+rtimer::EventLog::EventLog(keys::TimeSource time_src, uint8_t version, uint8_t first, uint8_t count) :
+    now(time_src),
+    store(version, first, count),
+    tail(0),
+    used(0),
+    unsaved(0),
+    events(0),
+    dropped(0)
+{
+    // only the newest record's place matters, the next save goes behind it
+    uint8_t rec[ConfigStore::PAYLOAD_SIZE];
+    store.load(rec);
+
+    base = last = now();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::EventLog::add(uint8_t head, uint16_t value, uint8_t value_bytes)
+{
+    unsigned long t = now();
+    uint32_t d = t - last;
+    uint8_t ev[MAX_EVENT],
+            n = 0;
+
+    ev[n++] = head;
+    while (d >= 0x80) {
+        ev[n++] = uint8_t(d) | 0x80;
+        d >>= 7;
+    }
+    ev[n++] = uint8_t(d);
+    for (uint8_t i = 0; i < value_bytes; i++)
+        ev[n++] = uint8_t(value >> (8 * i));
+
+    while (BYTES - used < n)
+        drop();
+
+    uint8_t h = tail + used;
+    for (uint8_t i = 0; i < n; i++)
+        buf[(h + i) & (BYTES - 1)] = ev[i];
+    used += n;
+    unsaved += n;
+    last = t;
+    events++;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::EventLog::peek(uint8_t at, uint8_t ev[MAX_EVENT]) const
+{
+    uint8_t n = used - at < MAX_EVENT ? used - at : MAX_EVENT;
+    for (uint8_t i = 0; i < n; i++)
+        ev[i] = buf[(tail + at + i) & (BYTES - 1)];
+
+    return n;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::EventLog::drop()
+{
+    uint8_t ev[MAX_EVENT];
+    uint16_t len = 0;
+    Event e;
+    e.at = base;
+    decode(ev, peek(0, ev), len, e);
+
+    // the next event's delta counts from the dropped one
+    base = e.at;
+    tail = (tail + len) & (BYTES - 1);
+    used -= len;
+    if (unsaved > used)
+        unsaved = used;
+    dropped++;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::EventLog::decode(const uint8_t *data, uint16_t len, uint16_t &pos, Event &e)
+{
+    while (pos < len && data[pos] == 0)
+        pos++;
+    if (pos >= len)
+        return false;
+
+    uint16_t p = pos;
+    e.type = data[p] >> 5;
+    e.arg = data[p++] & 0x1F;
+    e.value = 0;
+
+    if (e.type == evMark) {
+        if (p + 4 > len)
+            return false;
+        e.at = data[p] | uint32_t(data[p + 1]) << 8 | uint32_t(data[p + 2]) << 16 |
+               uint32_t(data[p + 3]) << 24;
+        pos = p + 4;
+
+        return true;
+    }
+
+    uint32_t d = 0;
+    uint8_t shift = 0,
+            b;
+    do {
+        if (p >= len || shift > 28)
+            return false;
+        b = data[p++];
+        d |= uint32_t(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    uint8_t bytes = e.type == evKey ? 1 : e.type == evPhase ? 2 : 0;
+    if (p + bytes > len)
+        return false;
+    for (uint8_t i = 0; i < bytes; i++)
+        e.value |= uint16_t(data[p++]) << (8 * i);
+    e.at += d;
+    pos = p;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::EventLog::pack(uint8_t at, uint32_t mark, bool write)
+{
+    uint8_t rec[ConfigStore::PAYLOAD_SIZE],
+            ev[MAX_EVENT],
+            fill = 0,
+            records = 1;
+
+    rec[fill++] = evMark << 5;
+    for (uint8_t i = 0; i < 4; i++)
+        rec[fill++] = uint8_t(mark >> (8 * i));
+
+    while (at < used) {
+        uint16_t len = 0;
+        Event e;
+        e.at = 0;
+        decode(ev, peek(at, ev), len, e);
+        // an event isn't split, the rest of the record is padding
+        if (fill + len > ConfigStore::PAYLOAD_SIZE) {
+            memset(rec + fill, 0, ConfigStore::PAYLOAD_SIZE - fill);
+            if (write)
+                store.append(rec);
+            fill = 0;
+            records++;
+        }
+        memcpy(rec + fill, ev, len);
+        fill += len;
+        at += len;
+    }
+    memset(rec + fill, 0, ConfigStore::PAYLOAD_SIZE - fill);
+    if (write)
+        store.append(rec);
+
+    return records;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::EventLog::save()
+{
+    if (unsaved == 0)
+        return false;
+
+    // the time of the event before the first one to save marks their start
+    uint8_t ev[MAX_EVENT],
+            at = 0;
+    Event e;
+    e.at = base;
+    while (at < used - unsaved) {
+        uint16_t len = 0;
+        decode(ev, peek(at, ev), len, e);
+        at += len;
+    }
+    // the store keeps just so many records, the oldest events of a longer
+    // run would only be written over by the newest ones
+    while (at < used && pack(at, 0, false) > store.get_slots()) {
+        uint16_t len = 0;
+        decode(ev, peek(at, ev), len, e);
+        at += len;
+    }
+
+    pack(at, e.at, true);
+    unsaved = 0;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::EventLog::print_hex(Print &out, uint8_t b)
+{
+    if (b < 0x10)
+        out.print('0');
+    out.print(b, HEX);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::EventLog::dump(Print &out) const
+{
+    out.print("log,");
+    out.println(base);
+
+    for (uint8_t i = 0; i < used; i++) {
+        print_hex(out, buf[(tail + i) & (BYTES - 1)]);
+        if ((i & 31) == 31 || i + 1 == used)
+            out.println();
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::EventLog::dump_saved(Print &out)
+{
+    uint8_t rec[ConfigStore::PAYLOAD_SIZE],
+            n = 0;
+    while (n < ConfigStore::MAX_SLOTS && store.read_back(n, rec))
+        n++;
+
+    out.println("log,0");
+    while (n-- > 0) {
+        store.read_back(n, rec);
+        for (uint8_t i = 0; i < ConfigStore::PAYLOAD_SIZE; i++)
+            print_hex(out, rec[i]);
+        out.println();
+    }
+}
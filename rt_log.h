@@ -0,0 +1,109 @@
+#ifndef __RT_LOG_H_
+#define __RT_LOG_H_
+
+#include <Arduino.h>
+#include <Keys.h>
+#include "rt_store.h"
+
+namespace rtimer {
+
+    // Session event log.
+    // The key events, the timers' state changes, their phases with the drawn
+    // lengths and the beeps go into a ring of bytes, the oldest events give
+    // way to the new ones. An event is
+    //   type << 5 | arg, the ms since the previous event [, value]
+    // and the ms are 7 bits a byte, the lowest first, the top bit set in all
+    // but the last byte. So a beep a second after the previous event is
+    // 3 bytes, a key 4 ones and a phase 5:
+    //   evKey    arg: mode,               value: code
+    //   evBeep   arg: voice << 3 | type
+    //   evState  arg: timer << 3 | state
+    //   evPhase  arg: timer << 3 | kind,  value: length in s, 2 LE bytes
+    //   evMark   the absolute ms of the previous event as 4 LE bytes instead
+    //            of the delta, it starts the events saved to the EEPROM
+    // Bytes 0 pad the records in the EEPROM.
+    // save() appends the events logged since the last save to records of a
+    // ConfigStore of its own, so the EEPROM keeps the last few dozen bytes of
+    // the log over a power off.
+    // On the ATmega328P the log takes 172 bytes of SRAM: the ring, 23 ones
+    // of its ConfigStore and 21 ones of the clock, times and counters
+    class EventLog {
+        public:
+            static const uint8_t
+                BYTES = 128,    // should be a power of 2
+                MAX_EVENT = 8;  // the longest event
+
+            typedef
+                enum {
+                    evPad,
+                    evKey,
+                    evBeep,
+                    evState,
+                    evPhase,
+                    evMark
+                } EventType;
+
+            // Decoded event
+            struct Event {
+                uint32_t at;    // ms, the previous event's plus the delta
+                uint8_t type;
+                uint8_t arg;
+                uint16_t value;
+            };
+
+            EventLog(keys::TimeSource time_src, uint8_t version, uint8_t first, uint8_t count);
+
+            void key(uint8_t code, uint8_t mode) { add(evKey << 5 | (mode & 0x1F), code, 1); };
+            void beep(uint8_t btype, uint8_t voice) { add(evBeep << 5 | voice << 3 | btype, 0, 0); };
+            void state(uint8_t timer, uint8_t st) { add(evState << 5 | timer << 3 | st, 0, 0); };
+            void phase(uint8_t timer, uint8_t kind, uint16_t secs) {
+                add(evPhase << 5 | timer << 3 | kind, secs, 2);
+            };
+
+            // Appends the events since the last save to the EEPROM records,
+            // each record holds whole events. Returns false if there was nothing
+            bool save();
+            bool is_saved() const { return unsaved == 0; };
+
+            // Writes the log as text: "log," and the absolute ms before the
+            // oldest event on the first line, then its bytes in hex, 32 a
+            // line. The saved events the same way from the oldest record,
+            // their times come from the marks
+            void dump(Print &out) const;
+            void dump_saved(Print &out);
+
+            // Decodes the event at pos of the bytes of a log, e.at goes on
+            // from the previous event. Skips the padding, false at the end
+            // or at an event cut short
+            static bool decode(const uint8_t *data, uint16_t len, uint16_t &pos, Event &e);
+
+            uint8_t size() const { return used; };
+            uint32_t get_events() const { return events; };
+            uint32_t get_dropped() const { return dropped; };
+
+        private:
+            keys::TimeSource now;
+            ConfigStore store;
+            uint8_t buf[BYTES];
+            uint8_t tail;       // the oldest event
+            uint8_t used;
+            uint8_t unsaved;    // bytes of the newest events save() hasn't written
+            unsigned long base; // the time before the oldest event
+            unsigned long last; // the time of the newest event
+            uint32_t events;
+            uint32_t dropped;
+
+            // The value takes value_bytes, LE
+            void add(uint8_t head, uint16_t value, uint8_t value_bytes);
+            // Copies the event at the offset from the oldest one out of the ring
+            uint8_t peek(uint8_t at, uint8_t ev[MAX_EVENT]) const;
+            void drop();
+            // Writes the events from the offset on to the records after a
+            // mark of the time before them. Returns the records it takes
+            uint8_t pack(uint8_t at, uint32_t mark, bool write);
+
+            static void print_hex(Print &out, uint8_t b);
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_LOG_H_
@@ -0,0 +1,192 @@
+#include "rt_plan.h"
+
+
+//------------------------------------------------------------------------------------------
+rtimer::Plan::Plan() :
+    seed(0),
+    prog(NULL),
+    used(0)
+{
+    memset(&base, 0, sizeof(base));
+    tail = head = base;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::Plan::width(const Program::Phase &op)
+{
+    uint8_t span = op.hi > op.lo ? op.hi - op.lo : 0,
+            bits = 0;
+    while (span != 0) {
+        span >>= 1;
+        bits++;
+    }
+
+    return bits;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Plan::start(uint32_t s, const Program &p)
+{
+    seed = s;
+    rng.seed(s);
+    prog = &p;
+    memset(&base, 0, sizeof(base));
+    tail = head = base;
+    used = 0;
+
+    fill();
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Plan::put(uint16_t bit, uint8_t bits, uint8_t v)
+{
+    if (bits == 0)
+        return;
+
+    // a field at the end of the ring goes on at its start
+    uint8_t i = bit >> 3,
+            j = i + 1 < BYTES ? i + 1 : 0,
+            sh = bit & 7;
+    uint16_t mask = ((1U << bits) - 1) << sh,
+             w = (buf[i] | uint16_t(buf[j]) << 8) & ~mask;
+    w |= uint16_t(v) << sh & mask;
+    buf[i] = uint8_t(w);
+    buf[j] = uint8_t(w >> 8);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::Plan::get(uint16_t bit, uint8_t bits) const
+{
+    if (bits == 0)
+        return 0;
+
+    uint8_t i = bit >> 3,
+            j = i + 1 < BYTES ? i + 1 : 0;
+    uint16_t w = buf[i] | uint16_t(buf[j]) << 8;
+
+    return (w >> (bit & 7)) & ((1U << bits) - 1);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Plan::take(Cursor &c, Phase &ph) const
+{
+    Program::Phase op;
+    if (prog == NULL || !prog->step(c.pc, op))
+        return false;
+
+    uint8_t w = width(op);
+    ph.kind = op.kind;
+    ph.secs = uint16_t(op.lo + get(c.bit, w)) * (op.minutes ? 60 : 1);
+    c.bit += w;
+    if (c.bit >= BITS)
+        c.bit -= BITS;
+    c.index++;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Plan::draw()
+{
+    Program::Cursor pc = head.pc;
+    Program::Phase op;
+    if (prog == NULL || !prog->step(pc, op))
+        return false;
+
+    // the room of the phases the engine has taken, the oldest first. The
+    // fixed ones take none, but the buffer keeps up to KEPT of them, so
+    // peek() walks a short run and the wrapping indexes keep their distance
+    uint8_t w = width(op);
+    while (used + w > BITS || uint16_t(head.index - base.index) >= KEPT) {
+        Cursor c = base;
+        Phase ph;
+        if (base.index == tail.index || !take(c, ph))
+            return false;
+        used -= c.bit >= base.bit ? c.bit - base.bit : c.bit + BITS - base.bit;
+        base = c;
+    }
+
+    put(head.bit, w, w == 0 ? 0 : rng.draw(Random::Distribution(op.mode - Program::pmUniform),
+                                           op.lo, op.hi) - op.lo);
+    head.pc = pc;
+    head.bit += w;
+    if (head.bit >= BITS)
+        head.bit -= BITS;
+    head.index++;
+    used += w;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Plan::fill()
+{
+    bool any = false;
+
+    // the indexes wrap in an endless session, so they are compared by distance
+    while (uint16_t(head.index - tail.index) < AHEAD && draw())
+        any = true;
+
+    return any;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Plan::next(Phase &ph)
+{
+    // the engine got ahead of fill(), e.g. a run of skipped phases
+    if (tail.index == head.index && !draw())
+        return false;
+
+    return take(tail, ph);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Plan::peek(uint16_t index, Phase &ph) const
+{
+    // by the distance from the first one, the indexes wrap
+    uint16_t at = index - base.index;
+    if (at >= uint16_t(head.index - base.index))
+        return false;
+
+    Cursor c = base;
+    while (take(c, ph))
+        if (uint16_t(c.index - base.index) > at)
+            return true;
+
+    return false;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Plan::dump(Print &out) const
+{
+    out.print("plan,");
+    out.print(seed, HEX);
+    out.print(',');
+    for (uint8_t i = 0; prog != NULL && i < prog->size(); i++) {
+        uint8_t b = prog->get_code()[i];
+        if (b < 0x10)
+            out.print('0');
+        out.print(b, HEX);
+    }
+    out.println();
+
+    Cursor c = base;
+    Phase ph;
+    while (c.index != head.index && take(c, ph)) {
+        out.print(c.index);
+        out.print(',');
+        out.print(ph.kind);
+        out.print(',');
+        out.println(ph.secs);
+    }
+}
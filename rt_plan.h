@@ -0,0 +1,96 @@
+#ifndef __RT_PLAN_H_
+#define __RT_PLAN_H_
+
+#include <Arduino.h>
+#include "rt_rand.h"
+#include "rt_prog.h"
+
+namespace rtimer {
+
+    // Session plan.
+    // All the phase lengths of a session's program are drawn before it
+    // starts, so a phase change only reads its length. Every length is kept
+    // as its offset from the phase's lo in just the bits the range needs (8
+    // for 30..180 s, 6 for 1..60 s, 3 for 4..10 min, none for a fixed one),
+    // in the phase's unit, a phase after
+    // phase in the program's order. The program tells the bits of every
+    // phase, so the buffer holds nothing else.
+    // A session of up to two dozen rounds fits into the buffer as a whole.
+    // An endless or a longer one gets the phases ahead of the engine and
+    // fill() draws the next ones over the oldest phases the engine has taken.
+    // The lengths come from a generator of their own seeded with seed, so
+    // the same seed and program give the same session again
+    class Plan {
+        public:
+            static const uint8_t
+                BYTES = 48,     // 27 rounds of the widest intervals
+                AHEAD = 0xFF;   // the most phases drawn ahead, for the fixed ones
+
+            // Phase of the session: its Program::Kind and length in s
+            struct Phase {
+                uint8_t kind;
+                uint16_t secs;
+            };
+
+            Plan();
+
+            // Starts a new plan of the program and draws as many phases as
+            // the buffer holds. The program should outlive the plan
+            void start(uint32_t s, const Program &p);
+            // Draws the phases the engine has freed the room for.
+            // Returns true if there was anything to draw
+            bool fill();
+
+            // Takes the session's next phase. A phase which isn't drawn yet
+            // is drawn on the spot. Taking a phase lets fill() reuse its room.
+            // false at the end of the program
+            bool next(Phase &ph);
+            // The phase of the index from get_first() to get_drawn() without
+            // taking it. It's looked up from the first one in the buffer
+            bool peek(uint16_t index, Phase &ph) const;
+
+            uint32_t get_seed() const { return seed; };
+            const Program* get_program() const { return prog; };
+            // The phases drawn so far, the first one still in the buffer and
+            // the next one the engine takes
+            uint16_t get_drawn() const { return head.index; };
+            uint16_t get_first() const { return base.index; };
+            uint16_t get_taken() const { return tail.index; };
+
+            // Writes the plan as text: the seed and the program's bytecode in
+            // hex on the first line, then a line of index, kind and length for
+            // every phase in the buffer
+            void dump(Print &out) const;
+
+        private:
+            static const uint16_t
+                BITS = BYTES * 8,
+                KEPT = 2 * AHEAD;   // the most phases in the buffer
+
+            // A phase of the program and its place in the buffer
+            struct Cursor {
+                Program::Cursor pc;
+                uint16_t bit;       // of the phase's offset, the buffer is a ring of BITS
+                uint16_t index;     // phases before it since start()
+            };
+
+            Random rng;
+            uint32_t seed;
+            const Program *prog;
+            Cursor base;        // the oldest phase in the buffer
+            Cursor tail;        // the next phase the engine takes
+            Cursor head;        // the next phase to draw
+            uint16_t used;      // bits from base to head
+            uint8_t buf[BYTES];
+
+            bool draw();
+            // Moves the cursor past its phase, the length goes to ph
+            bool take(Cursor &c, Phase &ph) const;
+            void put(uint16_t bit, uint8_t bits, uint8_t v);
+            uint8_t get(uint16_t bit, uint8_t bits) const;
+
+            static uint8_t width(const Program::Phase &op);
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_PLAN_H_
@@ -0,0 +1,149 @@
+#include "rt_prog.h"
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::add(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t n)
+{
+    // the last byte is kept for the END, so step() never runs past the code
+    if (len + n > (b0 >> 6 == opEnd ? MAX_BYTES : MAX_BYTES - 1))
+        return false;
+
+    code[len] = b0;
+    if (n > 1)
+        code[len + 1] = b1;
+    if (n > 2)
+        code[len + 2] = b2;
+    len += n;
+    // step() stops at the END behind the last instruction so far
+    if (len < MAX_BYTES)
+        code[len] = opEnd;
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::add_phase(uint8_t kind, uint8_t mode, uint16_t lo, uint16_t hi)
+{
+    if (mode == pmFixed || hi < lo)
+        hi = lo;
+
+    // a longer phase goes in minutes, a length which doesn't fit isn't cut
+    bool minutes = hi > MAX_SHORT;
+    if (kind >= pkCount || mode > pmExp ||
+        (minutes && (hi > MAX_SECS || lo % 60 != 0 || hi % 60 != 0)))
+        return false;
+    uint8_t unit = minutes ? 60 : 1;
+
+    return add(opPhase << 6 | minutes << 5 | kind << 2 | mode, lo / unit, hi / unit,
+               mode == pmFixed ? 2 : 3);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::add_repeat(uint8_t n)
+{
+    return add(opRepeat << 6, n, 0, 2);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::load_P(const uint8_t *src, uint8_t n)
+{
+    clear();
+    if (n > MAX_BYTES)
+        return false;
+
+    memcpy_P(code, src, n);
+    len = n;
+    if (check())
+        return true;
+
+    clear();
+
+    return false;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::check() const
+{
+    uint8_t depth = 0;
+    bool phases[DEPTH + 1] = {false};
+
+    for (uint8_t pc = 0; pc < len; pc += length(code[pc])) {
+        uint8_t b0 = code[pc];
+        if (pc + length(b0) > len)
+            return false;
+
+        switch (b0 >> 6) {
+            case opEnd:
+                return depth == 0;
+
+            case opPhase:
+                if ((b0 >> 2 & 7) >= pkCount)
+                    return false;
+                phases[depth] = true;
+                break;
+
+            case opRepeat:
+                if (depth == DEPTH)
+                    return false;
+                phases[++depth] = false;
+                break;
+
+            case opNext:
+                // an empty body would loop without ever getting to a phase
+                if (depth == 0 || !phases[depth])
+                    return false;
+                phases[--depth] = true;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    // no END: step() would run past the code
+    return false;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::Program::step(Cursor &c, Phase &ph) const
+{
+    for (;;) {
+        const uint8_t *p = &code[c.pc];
+        switch (p[0] >> 6) {
+            case opPhase:
+                ph.kind = p[0] >> 2 & 7;
+                ph.mode = p[0] & 3;
+                ph.minutes = p[0] >> 5 & 1;
+                ph.lo = p[1];
+                ph.hi = ph.mode == pmFixed ? p[1] : p[2];
+                c.pc += ph.mode == pmFixed ? 2 : 3;
+                return true;
+
+            case opRepeat:
+                c.pc += 2;
+                c.start[c.depth] = c.pc;
+                c.left[c.depth++] = p[1];
+                break;
+
+            case opNext: {
+                uint8_t &left = c.left[c.depth - 1];
+                if (left == 0 || --left > 0)
+                    c.pc = c.start[c.depth - 1];
+                else {
+                    c.depth--;
+                    c.pc++;
+                }
+                break;
+            }
+
+            default:
+                // the cursor stays at the END
+                return false;
+        }
+    }
+}
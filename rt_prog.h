@@ -0,0 +1,153 @@
+#ifndef __RT_PROG_H_
+#define __RT_PROG_H_
+
+#include <Arduino.h>
+
+namespace rtimer {
+
+    // Interval program.
+    // A session is a program of phases compiled to a bytecode: a phase is
+    // 2 bytes (a fixed length) or 3 ones (a range drawn by a distribution),
+    // a loop costs 3 bytes around its body. The first byte of an
+    // instruction is its op in the top 2 bits and its arguments below them,
+    // so its length is known from that byte alone:
+    //   PHASE   op | min << 5 | kind << 2 | mode, lo [, hi if mode isn't pmFixed]
+    //           lo and hi are in s, or in minutes with min set, so a phase
+    //           lasts up to 255 s to the second or up to 255 min in minutes
+    //   REPEAT  op, n      runs the body up to the matching NEXT n times, 0 forever
+    //   NEXT    op
+    //   END     op         0, so a zeroed program is an empty one
+    // The loop's start and count are kept in the cursor, so every instruction
+    // is decoded and executed in constant time and step() takes just the
+    // control instructions between two phases, at most two per loop level.
+    // The programs in the flash are written with the PRG_ macros below, e.g.
+    //   PRG_FIX(pkWarmUp, 120), PRG_REPEAT(8), PRG_DRAW(pkWork, pmUniform, 30, 60),
+    //   PRG_FIX(pkRest, 20), PRG_NEXT, PRG_FIX(pkBreak, 600), PRG_END
+    // and take the lengths in s, picking the unit themselves
+    class Program {
+        public:
+            static const uint8_t
+                MAX_BYTES = 32,
+                DEPTH = 2,      // loops in a loop
+                MAX_SHORT = 255;    // the longest phase kept in s
+            static const uint16_t MAX_SECS = 255 * 60;
+
+            typedef
+                enum {
+                    opEnd,
+                    opPhase,
+                    opRepeat,
+                    opNext
+                } Op;
+
+            // Phase kinds. The work-like ones are played as the timer,
+            // the others as the delay
+            typedef
+                enum {
+                    pkWork,
+                    pkRest,
+                    pkWarmUp,
+                    pkBreak,
+                    pkCoolDown,
+                    pkCount
+                } Kind;
+
+            // Phase length: fixed or drawn from lo to hi by the Random
+            // distribution mode - 1, as the timer's TimerMode
+            typedef
+                enum {
+                    pmFixed,
+                    pmUniform,
+                    pmNormal,
+                    pmExp
+                } Mode;
+
+            // Decoded PHASE instruction, hi == lo for a fixed one. The
+            // length is drawn in the unit, a minute if minutes is set
+            struct Phase {
+                uint8_t kind;
+                uint8_t mode;
+                bool minutes;
+                uint8_t lo;
+                uint8_t hi;
+            };
+
+            // Position of a run of the program. A zeroed one is its start
+            struct Cursor {
+                uint8_t pc;
+                uint8_t depth;
+                uint8_t start[DEPTH];   // the first instruction of the loop's body
+                uint8_t left[DEPTH];    // runs of the body left, 0 forever
+            };
+
+            Program() { clear(); }
+
+            // Compiles the program instruction by instruction, the last one
+            // should be add_end(). false if it doesn't fit, the last byte is
+            // kept for the END. The lengths are in s, a phase over MAX_SHORT
+            // takes whole minutes up to MAX_SECS
+            void clear() { len = 0; code[0] = opEnd; };
+            bool add_phase(uint8_t kind, uint8_t mode, uint16_t lo, uint16_t hi);
+            bool add_repeat(uint8_t n);
+            bool add_next() { return add(opNext << 6, 0, 0, 1); };
+            bool add_end() { return add(opEnd << 6, 0, 0, 1); };
+
+            // Copies a compiled program from the flash. One which doesn't
+            // pass check() is replaced by an empty one
+            bool load_P(const uint8_t *src, uint8_t n);
+            // The program ends, its loops are nested in DEPTH and every loop
+            // has a phase, so step() always gets to a phase or the end
+            bool check() const;
+
+            // Runs the program from the cursor up to the next phase and
+            // moves the cursor past it. false at the end of the program
+            bool step(Cursor &c, Phase &ph) const;
+
+            uint8_t size() const { return len; };
+            const uint8_t* get_code() const { return code; };
+
+            static bool is_work(uint8_t kind) { return kind == pkWork || kind == pkWarmUp; };
+
+        private:
+            uint8_t code[MAX_BYTES];
+            uint8_t len;
+
+            bool add(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t n);
+
+            static uint8_t length(uint8_t b0) {
+                uint8_t op = b0 >> 6;
+
+                return op == opPhase ? ((b0 & 3) == pmFixed ? 2 : 3) : op == opRepeat ? 2 : 1;
+            }
+    };
+
+    // Phase length of the PRG_ macros in s, encoded at compile time. A
+    // length which doesn't fit stops the build instead of being cut
+    template <unsigned long LO, unsigned long HI>
+    struct PrgLength {
+        static_assert(LO <= HI, "a phase's range should rise");
+        static_assert(HI <= Program::MAX_SHORT ||
+                      (HI <= Program::MAX_SECS && LO % 60 == 0 && HI % 60 == 0),
+                      "a phase lasts up to 255 s, or whole minutes up to 255 min");
+
+        static const uint8_t
+            unit = HI > Program::MAX_SHORT ? 60 : 1,
+            flags = (HI > Program::MAX_SHORT) << 5,
+            low = uint8_t(LO / unit),
+            high = uint8_t(HI / unit);
+    };
+}; // end of rtimer namespace
+
+#define PRG_FIX(kind, secs) \
+    uint8_t(rtimer::Program::opPhase << 6 | rtimer::PrgLength<secs, secs>::flags | \
+            rtimer::Program::kind << 2), \
+    rtimer::PrgLength<secs, secs>::low
+#define PRG_DRAW(kind, mode, lo, hi) \
+    uint8_t(rtimer::Program::opPhase << 6 | rtimer::PrgLength<lo, hi>::flags | \
+            rtimer::Program::kind << 2 | rtimer::Program::mode), \
+    rtimer::PrgLength<lo, hi>::low, rtimer::PrgLength<lo, hi>::high
+#define PRG_REPEAT(n) uint8_t(rtimer::Program::opRepeat << 6), uint8_t(n)
+#define PRG_NEXT uint8_t(rtimer::Program::opNext << 6)
+#define PRG_END uint8_t(rtimer::Program::opEnd << 6)
+
+#endif // __RT_PROG_H_
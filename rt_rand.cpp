@@ -0,0 +1,128 @@
+#include "rt_rand.h"
+
+
+namespace {
+
+    // -log2(x) of x = 0.5 + i / 64, i = 0..32, fixed point with 12 fraction bits
+    const uint16_t NLOG2[33] PROGMEM = {
+        4096, 3914, 3738, 3566, 3400, 3238, 3080, 2927, 2777, 2631, 2489, 2350, 2214, 2081, 1951, 1824,
+        1700, 1578, 1459, 1342, 1227, 1114, 1004,  896,  789,  684,  582,  481,  381,  284,  188,   93,
+           0
+    };
+
+    // ln 2 with 12 fraction bits
+    const uint32_t LN2_Q12 = 2839;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::Random::uniform(uint16_t lo, uint16_t hi)
+{
+    uint32_t range = uint32_t(hi) - lo + 1;
+    if (range > 0xFFFF)
+        return uint16_t(next() >> 16);
+
+    // the high half of a 16x16 bit product is the value (Lemire). The few
+    // products which would make some values more likely are drawn again
+    uint32_t m = uint32_t(uint16_t(next() >> 16)) * uint16_t(range);
+    if (uint16_t(m) < range) {
+        uint16_t t = uint16_t(0x10000UL - range) % uint16_t(range);
+        while (uint16_t(m) < t)
+            m = uint32_t(uint16_t(next() >> 16)) * uint16_t(range);
+    }
+
+    return lo + uint16_t(m >> 16);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::Random::normal(uint16_t lo, uint16_t hi)
+{
+    uint32_t range = uint32_t(hi) - lo + 1;
+
+    // the sum of 12 uniform 16-bit halves has the mean 6 << 16 and sigma 1 << 16,
+    // the 8 sigma around the mean span 1 << 19 and are scaled down to the range
+    uint32_t s;
+    do {
+        s = 0;
+        for (uint8_t i = 0; i < 6; i++) {
+            uint32_t r = next();
+            s += (r >> 16) + (r & 0xFFFF);
+        }
+    } while (s < (2UL << 16) || s >= (10UL << 16));
+
+    return lo + uint16_t((((s - (2UL << 16)) >> 3) * range) >> 16);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::Random::exponential(uint16_t lo, uint16_t hi)
+{
+    uint32_t range = uint32_t(hi) - lo + 1;
+
+    for (;;) {
+        // -ln(u) of a uniform u is exponential. Below 1 / 64 it's beyond the
+        // cut anyway, so -log2(u) is the leading zeros (5 at most) and the
+        // table of the normalized rest
+        uint32_t r = next();
+        if (r < (1UL << 26))
+            continue;
+
+        uint16_t nlog = 0;
+        while (!(r & 0x80000000UL)) {
+            r <<= 1;
+            nlog += 4096;
+        }
+
+        uint8_t i = (r >> 26) & 0x1F,
+                f = uint8_t(r >> 18);
+        uint16_t a = pgm_read_word(&NLOG2[i]),
+                 b = pgm_read_word(&NLOG2[i + 1]);
+        nlog += a - uint16_t((uint32_t(a - b) * f) >> 8);
+
+        // the mean is a quarter of the range, so the cut is at 4
+        uint32_t e = (uint32_t(nlog) * LN2_Q12) >> 12;
+        if (e >= (4UL << 12))
+            continue;
+
+        return lo + uint16_t((e * range) >> 14);
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::Random::draw(Distribution d, uint16_t lo, uint16_t hi)
+{
+    switch (d) {
+        case dNormal:
+            return normal(lo, hi);
+        case dExponential:
+            return exponential(lo, hi);
+        default:
+            return uniform(lo, hi);
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+uint32_t rtimer::Random::entropy(uint8_t pin, uint8_t samples)
+{
+    // FNV-1a over the samples and a murmur3 finalizer, so every noisy bit
+    // flips about half of the seed's bits
+    uint32_t h = 0x811C9DC5UL;
+    for (uint8_t i = 0; i < samples; i++) {
+        unsigned long t = micros();
+        uint16_t v = analogRead(pin);
+        t = micros() - t;
+
+        h = (h ^ v ^ (uint32_t(t) << 10)) * 16777619UL;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85EBCA6BUL;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35UL;
+    h ^= h >> 16;
+
+    return h;
+}
@@ -0,0 +1,59 @@
+#ifndef __RT_RAND_H_
+#define __RT_RAND_H_
+
+#include <Arduino.h>
+
+namespace rtimer {
+
+    // Random interval generator.
+    // A xorshift32 generator: three shifts and three xors a number, no
+    // multiplication or division, so it's a few dozen cycles on AVR where
+    // random() spends hundreds in its 32-bit division and modulo.
+    // The intervals are drawn in [lo, hi], both ends included, from one of
+    // the distributions:
+    //   dUniform      every value is as likely
+    //   dNormal       truncated normal: the mean is the middle, sigma an
+    //                 eighth of the span, cut at 4 sigma. Approximated by a
+    //                 sum of 12 uniform numbers (Irwin-Hall)
+    //   dExponential  lo plus an exponential one with the mean a quarter of
+    //                 the span, cut at hi: mostly short, now and then long
+    // The numbers are exact integers, the cut draws are taken again
+    class Random {
+        public:
+            typedef
+                enum {
+                    dUniform,
+                    dNormal,
+                    dExponential
+                } Distribution;
+
+            Random(uint32_t s = 1) { seed(s); }
+
+            // 0 isn't a valid state, it's replaced by a fixed one
+            void seed(uint32_t s) { state = s != 0 ? s : 0x2545F491UL; }
+
+            uint32_t next() {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+
+                return state;
+            }
+
+            // hi shouldn't be below lo
+            uint16_t uniform(uint16_t lo, uint16_t hi);
+            uint16_t normal(uint16_t lo, uint16_t hi);
+            uint16_t exponential(uint16_t lo, uint16_t hi);
+            uint16_t draw(Distribution d, uint16_t lo, uint16_t hi);
+
+            // Seed out of the noise of samples conversions of an analog pin
+            // with nothing attached. The lowest bits of every conversion and
+            // the time it took are folded into the hash
+            static uint32_t entropy(uint8_t pin, uint8_t samples = 32);
+
+        private:
+            uint32_t state;
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_RAND_H_
@@ -0,0 +1,131 @@
+#include "rt_sched.h"
+
+
+//------------------------------------------------------------------------------------------
+rtimer::Scheduler::Scheduler() :
+    count(0),
+    heap_len(0)
+{
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::Scheduler::add(TaskProc proc, void *ctx, const char *name, uint16_t budget_us,
+                               unsigned long due)
+{
+    if (count >= MAX_TASKS)
+        return NO_TASK;
+
+    Task &t = tasks[count];
+    t.proc = proc;
+    t.ctx = ctx;
+    t.due = due;
+    t.slot = NO_TASK;
+    t.stats.name = name;
+    t.stats.runs = 0;
+    t.stats.wcet_us = 0;
+    t.stats.overruns = 0;
+    t.stats.budget_us = budget_us;
+
+    wake(count, due);
+
+    return count++;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Scheduler::wake(uint8_t id, unsigned long at)
+{
+    if (id >= MAX_TASKS || at == keys::NO_DEADLINE)
+        return;
+
+    Task &t = tasks[id];
+    if (t.slot != NO_TASK) {
+        if (long(at - t.due) >= 0)
+            return;
+        t.due = at;
+        sift_up(t.slot);
+        return;
+    }
+
+    t.due = at;
+    place(heap_len, id);
+    sift_up(heap_len++);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Scheduler::run(unsigned long now)
+{
+    while (heap_len > 0 && long(now - tasks[heap[0]].due) >= 0) {
+        uint8_t id = pop();
+        Task &t = tasks[id];
+
+        unsigned long start = micros();
+        unsigned long next = t.proc(t.ctx, now);
+        uint32_t took = micros() - start;
+
+        t.stats.runs++;
+        if (took > t.stats.wcet_us)
+            t.stats.wcet_us = took;
+        if (took > t.stats.budget_us)
+            t.stats.overruns++;
+
+        // the task could have been woken by another one meanwhile
+        wake(id, next);
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::Scheduler::next_deadline() const
+{
+    return heap_len > 0 ? tasks[heap[0]].due : keys::NO_DEADLINE;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Scheduler::sift_up(uint8_t pos)
+{
+    while (pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!earlier(pos, parent))
+            break;
+        swap(pos, parent);
+        pos = parent;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::Scheduler::sift_down(uint8_t pos)
+{
+    for (;;) {
+        uint8_t first = pos,
+                left = 2 * pos + 1,
+                right = left + 1;
+        if (left < heap_len && earlier(left, first))
+            first = left;
+        if (right < heap_len && earlier(right, first))
+            first = right;
+        if (first == pos)
+            break;
+        swap(pos, first);
+        pos = first;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::Scheduler::pop()
+{
+    uint8_t id = heap[0];
+
+    tasks[id].slot = NO_TASK;
+    if (--heap_len > 0) {
+        place(0, heap[heap_len]);
+        sift_down(0);
+    }
+
+    return id;
+}
@@ -0,0 +1,88 @@
+#ifndef __RT_SCHED_H_
+#define __RT_SCHED_H_
+
+#include <Arduino.h>
+#include <Keys.h>
+
+namespace rtimer {
+
+    // Cooperative scheduler of the main loop.
+    // Every task has its next-run deadline and the due ones are kept in a binary
+    // min-heap, so a pass costs nothing until the earliest deadline comes
+    class Scheduler {
+        public:
+            static const uint8_t
+                MAX_TASKS = 6,  // RTimer's tasks
+                NO_TASK = 0xFF;
+
+            // Task body. Gets the time of the pass and returns its next deadline
+            // or keys::NO_DEADLINE to sleep until another task or an interrupt
+            // source wakes it. The returned deadline should be in the future
+            typedef unsigned long (*TaskProc)(void *ctx, unsigned long now);
+
+            // Per-task profile. Execution time is measured with micros()
+            struct TaskStats {
+                const char *name;
+                uint32_t runs;
+                uint32_t wcet_us;     // the longest run
+                uint32_t overruns;    // runs longer than the task's budget
+                uint16_t budget_us;
+            };
+
+            Scheduler();
+
+            // Registers a task and returns its id or NO_TASK if there is no room
+            uint8_t add(TaskProc proc, void *ctx, const char *name, uint16_t budget_us,
+                        unsigned long due = keys::NO_DEADLINE);
+
+            // Makes the task due at the given time unless it's already due earlier
+            void wake(uint8_t id, unsigned long at);
+
+            // Runs every task due at now in the deadline order
+            void run(unsigned long now);
+
+            // Deadline of the earliest task or keys::NO_DEADLINE
+            unsigned long next_deadline() const;
+
+            uint8_t size() const { return count; };
+            const TaskStats& get_stats(uint8_t id) const { return tasks[id].stats; };
+
+        private:
+            struct Task {
+                TaskProc proc;
+                void *ctx;
+                unsigned long due;
+                uint8_t slot;       // index in the heap or NO_TASK while sleeping
+                TaskStats stats;
+            };
+
+            Task tasks[MAX_TASKS];
+            uint8_t count;
+
+            uint8_t heap[MAX_TASKS];
+            uint8_t heap_len;
+
+            // deadlines are compared through their difference, so the heap
+            // survives the millis() wrap-around
+            bool earlier(uint8_t a, uint8_t b) const {
+                return long(tasks[heap[a]].due - tasks[heap[b]].due) < 0;
+            }
+
+            void place(uint8_t pos, uint8_t id) {
+                heap[pos] = id;
+                tasks[id].slot = pos;
+            }
+
+            void swap(uint8_t a, uint8_t b) {
+                uint8_t id = heap[a];
+                place(a, heap[b]);
+                place(b, id);
+            }
+
+            void sift_up(uint8_t pos);
+            void sift_down(uint8_t pos);
+            uint8_t pop();
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_SCHED_H_
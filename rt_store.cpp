@@ -0,0 +1,155 @@
+#include "rt_store.h"
+#include <EEPROM.h>
+
+
+//------------------------------------------------------------------------------------------
+rtimer::ConfigStore::ConfigStore(uint8_t version, uint8_t first, uint8_t count) :
+    version(version),
+    first(first),
+    slots(0),
+    total(0),
+    slot(0),
+    seq(0),
+    valid(false),
+    writes(0)
+{
+    uint16_t n = EEPROM.length() / RECORD_SIZE;
+    total = n > MAX_SLOTS ? MAX_SLOTS : uint8_t(n);
+    if (first < total)
+        slots = count < total - first ? count : total - first;
+    // the very first record goes to the first slot
+    slot = first + slots - 1;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::ConfigStore::crc16(const uint8_t *data, uint8_t len)
+{
+    // CRC-16/CCITT-FALSE, bitwise to keep the flash free of tables
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc ^= uint16_t(*data++) << 8;
+        for (uint8_t i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    return crc;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::ConfigStore::read_record(uint8_t s, uint8_t rec[RECORD_SIZE])
+{
+    uint16_t addr = uint16_t(s) * RECORD_SIZE;
+    for (uint8_t i = 0; i < RECORD_SIZE; i++)
+        rec[i] = EEPROM.read(addr + i);
+
+    if (rec[0] != version)
+        return false;
+
+    return crc16(rec, RECORD_SIZE - 2) ==
+           (rec[RECORD_SIZE - 2] | uint16_t(rec[RECORD_SIZE - 1]) << 8);
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::ConfigStore::load(uint8_t data[PAYLOAD_SIZE])
+{
+    uint8_t rec[RECORD_SIZE];
+
+    valid = false;
+    for (uint8_t s = 0; s < total; s++) {
+        if (!read_record(s, rec))
+            continue;
+
+        uint16_t rseq = rec[1] | uint16_t(rec[2]) << 8;
+        // the ring holds the last writes only, so seq is compared by its distance
+        if (valid && int16_t(rseq - seq) <= 0)
+            continue;
+
+        valid = true;
+        slot = s;
+        seq = rseq;
+        memcpy(last, rec + 3, PAYLOAD_SIZE);
+    }
+
+    if (!valid)
+        return false;
+
+    memcpy(data, last, PAYLOAD_SIZE);
+    if (slot < first || slot >= first + slots) {
+        valid = false;
+        save(data);
+    }
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::ConfigStore::save(const uint8_t data[PAYLOAD_SIZE])
+{
+    if (valid && memcmp(data, last, PAYLOAD_SIZE) == 0)
+        return;
+
+    append(data);
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::ConfigStore::append(const uint8_t data[PAYLOAD_SIZE])
+{
+    uint8_t rec[RECORD_SIZE];
+    rec[0] = version;
+    rec[1] = uint8_t(seq + 1);
+    rec[2] = uint8_t((seq + 1) >> 8);
+    memcpy(rec + 3, data, PAYLOAD_SIZE);
+    uint16_t crc = crc16(rec, RECORD_SIZE - 2);
+    rec[RECORD_SIZE - 2] = uint8_t(crc);
+    rec[RECORD_SIZE - 1] = uint8_t(crc >> 8);
+
+    // the newest record stays untouched until the new one is complete
+    if (slots == 0)
+        return;
+
+    uint8_t s = slot >= first && slot + 1 < first + slots ? slot + 1 : first;
+    uint16_t addr = uint16_t(s) * RECORD_SIZE;
+    for (uint8_t i = 0; i < RECORD_SIZE; i++)
+        EEPROM.update(addr + i, rec[i]);
+
+    slot = s;
+    seq++;
+    valid = true;
+    memcpy(last, data, PAYLOAD_SIZE);
+    writes++;
+}
+
+
+//------------------------------------------------------------------------------------------
+bool rtimer::ConfigStore::read_back(uint8_t age, uint8_t data[PAYLOAD_SIZE])
+{
+    if (!valid || age >= slots)
+        return false;
+
+    // the records go round the store's slots one after another
+    uint8_t s = slot - first >= age ? slot - age : slot + slots - age,
+            rec[RECORD_SIZE];
+    if (!read_record(s, rec) || uint16_t(rec[1] | uint16_t(rec[2]) << 8) != uint16_t(seq - age))
+        return false;
+
+    memcpy(data, rec + 3, PAYLOAD_SIZE);
+
+    return true;
+}
+
+
+//------------------------------------------------------------------------------------------
+uint16_t rtimer::ConfigStore::diff(const uint8_t data[PAYLOAD_SIZE])
+{
+    uint16_t mask = 0;
+    for (uint8_t i = 0; i < PAYLOAD_SIZE; i++)
+        if (!valid || data[i] != last[i])
+            mask |= 1 << i;
+
+    return mask;
+}
@@ -0,0 +1,71 @@
+#ifndef __RT_STORE_H_
+#define __RT_STORE_H_
+
+#include <Arduino.h>
+
+namespace rtimer {
+
+    // Log-structured settings store.
+    // Every save() appends a record to the next slot of a ring over the
+    // store's own range of slots, so the writes are spread over its cells
+    // instead of hitting the same dozen addresses. RTimer's settings get
+    // the SETTINGS_SLOTS slots from SETTINGS_FIRST (50 of the 64), a cell of
+    // them is written every 50 saves or so: about 5 million edits before
+    // it's worn to 100000 cycles (rtsim wear). A record is
+    //   version, seq (LE), payload[PAYLOAD_SIZE], CRC-16 (LE)
+    // and the valid record with the newest seq wins. A torn write leaves a bad
+    // CRC behind and the previous record is loaded instead.
+    // The version byte tells the kinds of records apart, so several stores could
+    // share the EEPROM, each writing its own range of slots.
+    // Version 1 payload: tmode, tmin, tmax, dmode, dmin, dmax, trmode, trlimit,
+    // start countdown, end countdown, backlit
+    class ConfigStore {
+        public:
+            static const uint8_t
+                VERSION = 1,
+                RECORD_SIZE = 16,
+                PAYLOAD_SIZE = RECORD_SIZE - 5,
+                MAX_SLOTS = 64;
+
+            // Records of the version go to count slots from the first one on
+            ConfigStore(uint8_t version = VERSION, uint8_t first = 0, uint8_t count = MAX_SLOTS);
+
+            // Finds the newest valid record of the version in the whole EEPROM
+            // and copies its payload. A record outside the store's slots (left
+            // there by a wider store) is moved into them. Returns false if there is none
+            bool load(uint8_t data[PAYLOAD_SIZE]);
+            // Appends a record unless the payload is the same as the last one
+            void save(const uint8_t data[PAYLOAD_SIZE]);
+            // Appends a record whatever the payload, for a store whose
+            // records are a log rather than the last state
+            void append(const uint8_t data[PAYLOAD_SIZE]);
+            // Copies the payload of the record written age records before
+            // the newest one. false if it's gone or was never written
+            bool read_back(uint8_t age, uint8_t data[PAYLOAD_SIZE]);
+            // Bitmask of the payload bytes which differ from the newest record
+            uint16_t diff(const uint8_t data[PAYLOAD_SIZE]);
+
+            // A record of the version was loaded or written
+            bool has_record() { return valid; };
+            uint32_t get_writes() { return writes; };
+            uint16_t get_seq() { return seq; };
+            uint8_t get_slots() { return slots; };
+
+            static uint16_t crc16(const uint8_t *data, uint8_t len);
+
+        private:
+            uint8_t version;
+            uint8_t first;
+            uint8_t slots;
+            uint8_t total;      // slots of the whole EEPROM
+            uint8_t slot;       // the slot of the newest record
+            uint16_t seq;
+            bool valid;         // last holds the newest record
+            uint8_t last[PAYLOAD_SIZE];
+            uint32_t writes;    // records written since power on
+
+            bool read_record(uint8_t s, uint8_t rec[RECORD_SIZE]);
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_STORE_H_
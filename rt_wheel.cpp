@@ -0,0 +1,128 @@
+#include "rt_wheel.h"
+
+
+//------------------------------------------------------------------------------------------
+rtimer::TimerWheel::TimerWheel() :
+    count(0),
+    tick(0)
+{
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++)
+        entries[i].slot = NONE;
+    memset(heads, NONE, sizeof(heads));
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::TimerWheel::unlink(uint8_t id)
+{
+    Entry &e = entries[id];
+
+    if (e.prev != NONE)
+        entries[e.prev].next = e.next;
+    else
+        heads[e.slot] = e.next;
+    if (e.next != NONE)
+        entries[e.next].prev = e.prev;
+
+    e.slot = NONE;
+    count--;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::TimerWheel::set(uint8_t id, unsigned long at)
+{
+    if (id >= MAX_ENTRIES)
+        return;
+    if (entries[id].slot != NONE)
+        unlink(id);
+
+    // an empty wheel has no sweep to keep up with
+    unsigned long t = tick_of(at);
+    if (count == 0)
+        tick = t;
+    // a deadline behind the sweep goes to the bucket the sweep starts at
+    if (since(t, tick) < 0)
+        t = tick;
+
+    Entry &e = entries[id];
+    e.at = at;
+    e.slot = slot_of(t);
+    e.prev = NONE;
+    e.next = heads[e.slot];
+    if (e.next != NONE)
+        entries[e.next].prev = id;
+    heads[e.slot] = id;
+    count++;
+}
+
+
+//------------------------------------------------------------------------------------------
+void rtimer::TimerWheel::cancel(uint8_t id)
+{
+    if (is_set(id))
+        unlink(id);
+}
+
+
+//------------------------------------------------------------------------------------------
+uint8_t rtimer::TimerWheel::expired(unsigned long now)
+{
+    unsigned long nt = tick_of(now);
+    if (count == 0) {
+        tick = nt;
+        return NONE;
+    }
+
+    // a whole rotation looks into every bucket anyway
+    if (since(nt, tick) >= int32_t(SLOTS * TICK))
+        tick = nt - (SLOTS - 1) * TICK;
+
+    for (;;) {
+        for (uint8_t id = heads[slot_of(tick)]; id != NONE; id = entries[id].next)
+            if (since(entries[id].at, now) <= 0) {
+                unlink(id);
+                return id;
+            }
+
+        // the current tick's bucket could get due entries later in the tick
+        if (since(nt, tick) <= 0)
+            return NONE;
+        tick += TICK;
+    }
+}
+
+
+//------------------------------------------------------------------------------------------
+unsigned long rtimer::TimerWheel::next_deadline() const
+{
+    if (count == 0)
+        return keys::NO_DEADLINE;
+
+    // the first bucket with a deadline of its own rotation holds the earliest one
+    for (uint8_t k = 0; k < SLOTS; k++) {
+        unsigned long t = tick + k * TICK;
+        bool found = false;
+        unsigned long best = 0;
+        for (uint8_t id = heads[slot_of(t)]; id != NONE; id = entries[id].next) {
+            const Entry &e = entries[id];
+            if (since(tick_of(e.at), t) <= 0 && (!found || since(e.at, best) < 0)) {
+                best = e.at;
+                found = true;
+            }
+        }
+        if (found)
+            return best;
+    }
+
+    // every deadline is a rotation or more away
+    bool found = false;
+    unsigned long best = 0;
+    for (uint8_t id = 0; id < MAX_ENTRIES; id++)
+        if (entries[id].slot != NONE && (!found || since(entries[id].at, best) < 0)) {
+            best = entries[id].at;
+            found = true;
+        }
+
+    return best;
+}
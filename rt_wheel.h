@@ -0,0 +1,67 @@
+#ifndef __RT_WHEEL_H_
+#define __RT_WHEEL_H_
+
+#include <Arduino.h>
+#include <Keys.h>
+
+namespace rtimer {
+
+    // Hashed timing wheel of the timers' deadlines.
+    // A deadline goes to the bucket of its tick (the ms >> SHIFT) modulo SLOTS,
+    // a bucket is a list threaded through the entries. Setting or cancelling
+    // an entry is a few links whatever the number of entries, and a pass only
+    // looks into the buckets of the ticks gone by since the last one, so its
+    // cost is the entries which share those buckets, not all of them.
+    // A deadline a rotation or more ahead shares the bucket with the nearer
+    // ones and is just skipped until its time comes
+    class TimerWheel {
+        public:
+            static const uint8_t
+                SLOTS = 16,     // should be a power of 2
+                SHIFT = 6,      // 64 ms ticks, a rotation is about a second
+                MAX_ENTRIES = 4,
+                NONE = 0xFF;
+
+            TimerWheel();
+
+            // (Re)schedules the entry at the time. A deadline already gone by
+            // is taken by the next expired() call
+            void set(uint8_t id, unsigned long at);
+            void cancel(uint8_t id);
+            bool is_set(uint8_t id) const { return id < MAX_ENTRIES && entries[id].slot != NONE; };
+
+            // Takes out an entry whose deadline is at or before now, the ones of
+            // the earlier ticks first. NONE if no entry is due
+            uint8_t expired(unsigned long now);
+
+            // The earliest deadline or keys::NO_DEADLINE
+            unsigned long next_deadline() const;
+
+            uint8_t size() const { return count; };
+
+        private:
+            struct Entry {
+                unsigned long at;
+                uint8_t next;
+                uint8_t prev;
+                uint8_t slot;   // the bucket or NONE if the entry isn't set
+            };
+
+            static const unsigned long TICK = 1UL << SHIFT;
+
+            Entry entries[MAX_ENTRIES];
+            uint8_t heads[SLOTS];
+            uint8_t count;
+            unsigned long tick;     // the first ms of the tick the next sweep starts at
+
+            void unlink(uint8_t id);
+
+            // The ticks are kept in ms and shifted only to pick the bucket,
+            // so they wrap with millis() and compare by their signed distance
+            static unsigned long tick_of(unsigned long ms) { return ms & ~(TICK - 1); };
+            static uint8_t slot_of(unsigned long t) { return (t >> SHIFT) & (SLOTS - 1); };
+            static int32_t since(unsigned long a, unsigned long b) { return int32_t(uint32_t(a - b)); };
+    };
+}; // end of rtimer namespace
+
+#endif // __RT_WHEEL_H_
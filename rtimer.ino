@@ -1,13 +1,34 @@
 #include "rt.h"
 
+// 1 answers rtlog's requests on the serial port. Serial's buffers take
+// 157 bytes of SRAM on top of the 172 ones of the event log
+#define RT_SERIAL 0
+
 rtimer::RTimer rtm(rtimer::lcp, keys::P_KEYBOARD, rtimer::P_BEEPER);
 
+// the keyboard is sampled by the ADC interrupt
+KEYS_ADC_VECTOR();
+
 void setup() {
   // put your setup code here, to run once:
-
+  rtm.begin();
+#if RT_SERIAL
+  Serial.begin(9600);
+#endif
 }
 
 void loop() {
   // put your main code here, to run repeatedly:
   rtm.run();
+#if RT_SERIAL
+  // the logs and the plan for rtlog on request: l - the RAM log,
+  // e - the one saved to the EEPROM, p - the plan
+  switch (Serial.available() > 0 ? Serial.read() : -1) {
+    case 'l': rtm.dump_log(Serial); break;
+    case 'e': rtm.dump_saved_log(Serial); break;
+    case 'p': rtm.dump_plan(Serial); break;
+  }
+#endif
+  // sleep until the timer or the keyboard has something to do
+  rtm.sleep();
 }